@@ -0,0 +1,91 @@
+//==--- ASTCache.h - On-disk cache of parsed programs ---------------------===//
+//===----------------------------------------------------------------------===//
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clang/Basic/Diagnostic.h"
+#include "clang/Basic/FileSystemOptions.h"
+#include "clang/Basic/Version.h"
+#include "clang/Frontend/ASTUnit.h"
+#include "clang/Frontend/CompilerInstance.h"
+#include "clang/Serialization/PCHContainerOperations.h"
+#include "clang/Tooling/Tooling.h"
+#include "llvm/ADT/SmallString.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/MD5.h"
+#include "llvm/Support/Path.h"
+
+using namespace clang;
+
+// ASTCache turns source code into an ASTUnit. Given a directory, it saves
+// every AST it parses there as an AST file named after a hash of the source,
+// the compiler arguments and the Clang version, and loads that file instead
+// of parsing when the same source comes again.
+class ASTCache {
+  std::string mDir;
+  // Extra compiler arguments; they are part of the key.
+  std::vector<std::string> mArgs;
+  std::shared_ptr<PCHContainerOperations> mPCHOps;
+
+public:
+  // Without a directory every request is parsed.
+  explicit ASTCache(const std::string &dir)
+      : mDir(dir), mPCHOps(std::make_shared<PCHContainerOperations>()) {}
+
+  // The AST of `code`, or NULL if it cannot be parsed. `hit` tells whether
+  // it came from the cache.
+  std::unique_ptr<ASTUnit> get(const std::string &code, bool &hit) {
+    hit = false;
+    std::string path;
+    if (!mDir.empty()) {
+      path = pathFor(code);
+      if (llvm::sys::fs::exists(path)) {
+        std::unique_ptr<ASTUnit> unit = ASTUnit::LoadFromASTFile(
+            path, mPCHOps->getRawReader(), ASTUnit::LoadEverything,
+            CompilerInstance::createDiagnostics(new DiagnosticOptions()),
+            FileSystemOptions());
+        // An unreadable file is parsed again and replaced.
+        if (unit) {
+          hit = true;
+          return unit;
+        }
+      }
+    }
+    std::unique_ptr<ASTUnit> unit = tooling::buildASTFromCodeWithArgs(
+        code, mArgs, "input.cc", "clang-tool", mPCHOps);
+    if (unit && !path.empty() && !unit->getDiagnostics().hasErrorOccurred())
+      store(*unit, path);
+    return unit;
+  }
+
+private:
+  std::string pathFor(const std::string &code) const {
+    llvm::MD5 md5;
+    md5.update(CLANG_VERSION_STRING);
+    for (size_t i = 0; i < mArgs.size(); i++) {
+      md5.update(llvm::StringRef("", 1));
+      md5.update(mArgs[i]);
+    }
+    md5.update(llvm::StringRef("", 1));
+    md5.update(code);
+    llvm::MD5::MD5Result result;
+    md5.final(result);
+    std::string name(result.digest().str());
+    llvm::SmallString<128> path(mDir);
+    llvm::sys::path::append(path, name + ".ast");
+    return std::string(path.str());
+  }
+
+  // Failing to store only costs a parse next time, so errors are ignored.
+  // The file is written under a unique name and renamed into place, so
+  // runs and threads sharing the directory never load a partial file.
+  void store(ASTUnit &unit, const std::string &path) {
+    llvm::SmallString<128> tmp;
+    if (llvm::sys::fs::create_directories(mDir) ||
+        llvm::sys::fs::createUniqueFile(path + "-%%%%%%%%.tmp", tmp))
+      return;
+    if (unit.Save(tmp) || llvm::sys::fs::rename(tmp, path))
+      llvm::sys::fs::remove(tmp);
+  }
+};
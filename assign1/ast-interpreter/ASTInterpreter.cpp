@@ -2,175 +2,974 @@
 //--------------===//
 //===----------------------------------------------------------------------===//
 
+#include <stdio.h>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/EvaluatedExprVisitor.h"
-#include "clang/Frontend/CompilerInstance.h"
-#include "clang/Frontend/FrontendAction.h"
-#include "clang/Tooling/Tooling.h"
+#include "llvm/Support/CommandLine.h"
+#include "llvm/Support/FileSystem.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/MemoryBuffer.h"
+#include "llvm/Support/Path.h"
 
 using namespace clang;
 
-#include "Environment.h"
+#include "ASTCache.h"
+#include "Bytecode.h"
+#include "Profiler.h"
+
+static llvm::cl::opt<std::string> SourceCode(llvm::cl::Positional,
+                                             llvm::cl::desc("<source code>"));
+static llvm::cl::opt<bool>
+    TreeWalk("tree-walk",
+             llvm::cl::desc("Walk the AST instead of running bytecode"));
+static llvm::cl::opt<bool>
+    HeapStats("heap-stats",
+              llvm::cl::desc("Report MALLOC/FREE statistics on exit"));
+static llvm::cl::opt<bool>
+    NoMemo("no-memo",
+           llvm::cl::desc("Do not memoize calls to pure functions"));
+static llvm::cl::opt<bool>
+    MemoStats("memo-stats",
+              llvm::cl::desc("Report memoization hits and misses on exit"));
+static llvm::cl::opt<bool>
+    EvalStats("eval-stats",
+              llvm::cl::desc("Report the AST nodes the walker evaluated on "
+                             "exit"));
+static llvm::cl::opt<unsigned> JitThreshold(
+    "jit-threshold",
+    llvm::cl::desc("Compile a function to native code after this many calls "
+                   "and loop iterations, 0 to never"),
+    llvm::cl::init(1000));
+static llvm::cl::opt<bool>
+    JitStats("jit-stats",
+             llvm::cl::desc("Report native compilation on exit"));
+static llvm::cl::opt<std::string> ProfileFile(
+    "profile",
+    llvm::cl::desc("Walk the AST, writing a line and function profile to "
+                   "<file> and folded call stacks to <file>.folded"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<bool>
+    ToStdout("stdout",
+             llvm::cl::desc("PRINT to stdout and do not prompt for GET"));
+static llvm::cl::opt<std::string>
+    InputFile("input", llvm::cl::desc("Read GET values from <file>"),
+              llvm::cl::value_desc("file"));
+static llvm::cl::opt<std::string>
+    CacheDir("ast-cache",
+             llvm::cl::desc("Keep parsed programs in <dir> and reuse them"),
+             llvm::cl::value_desc("dir"));
+static llvm::cl::opt<bool>
+    Time("time", llvm::cl::desc("Report parse or cache-load time, run "
+                                "time and peak memory on exit"));
+static llvm::cl::opt<bool>
+    Server("server", llvm::cl::desc("Run the programs framed on stdin and "
+                                    "answer each on stdout"));
+static llvm::cl::opt<std::string>
+    BatchDir("batch", llvm::cl::desc("Run every .c file in <dir>"),
+             llvm::cl::value_desc("dir"));
+static llvm::cl::opt<unsigned>
+    Jobs("jobs", llvm::cl::desc("Programs to run at once in --batch mode "
+                                "(default: one per core)"),
+         llvm::cl::init(0));
+static llvm::cl::opt<std::string> ForkInputs(
+    "fork-inputs",
+    llvm::cl::desc("Set the program up once, then run it in a forked process "
+                   "for each line of GET values in <file>"),
+    llvm::cl::value_desc("file"));
+static llvm::cl::opt<unsigned> StackSize(
+    "stack-size",
+    llvm::cl::desc("Fail once interpreted calls take more than <MiB> of "
+                   "frames (default 1024)"),
+    llvm::cl::value_desc("MiB"), llvm::cl::init(1024));
+
+// How to run the program, as given on the command line.
+struct InterpreterOptions {
+  bool treeWalk;
+  bool heapStats;
+  bool memoize;
+  bool memoStats;
+  bool evalStats;
+  unsigned jitThreshold;
+  bool jitStats;
+  std::string profileFile;
+  bool toStdout;
+  std::string inputFile;
+  bool time;
+  // Bytes the frames of interpreted calls may take.
+  size_t stackSize;
+};
 
-// Use ReturnException as a signal to finish a function.
-class ReturnException : public std::exception {};
+// How the statement executed last finished. Anything but CS_Normal makes the
+// walker drop the tasks of the enclosing statements until the construct it
+// targets consumes it: a call for CS_Return, a loop for CS_Break and
+// CS_Continue.
+enum Completion { CS_Normal, CS_Return, CS_Break, CS_Continue };
 
+// The AST walker. It never recurses on the native stack for the program it
+// runs: what is left to do is a stack of Tasks on the heap, so an
+// interpreted call costs a few Tasks and a StackFrame, and how deep the
+// program may recurse is set by --stack-size instead of the host thread.
+//
+// A Task is a statement in progress or an expression being evaluated. An
+// expression is evaluated by stepping through its schedule, the nodes of its
+// tree in post-order. Operands are in their slots by the time their operator
+// comes up, so each Visit method only computes its own node. A call to an
+// interpreted function suspends the schedule until the callee returns.
 class InterpreterVisitor : public EvaluatedExprVisitor<InterpreterVisitor> {
+  enum TaskKind { TK_Stmt, TK_Expr, TK_Call };
+  // The part of a loop that runs next; a `continue` resumes at LP_Next.
+  enum LoopPos { LP_Init, LP_Cond, LP_Test, LP_Next };
+
+  struct Task {
+    TaskKind kind;
+    // For TK_Expr, the next node of the schedule and where it ends. For a
+    // block, the next statement; for a loop, its LoopPos; other statements
+    // only tell whether they started.
+    unsigned pos, end;
+    Stmt *stmt;
+    union {
+      // For TK_Call, the call the function returns from, or NULL for the
+      // entry function.
+      const CallSite *site;
+      // For a counted for-loop, what makes it one.
+      const CountedLoop *loop;
+    };
+    // The bound of a counted loop, once evaluated.
+    int64_t bound;
+  };
+
 public:
   explicit InterpreterVisitor(const ASTContext &context, Environment *env)
-      : EvaluatedExprVisitor(context), mEnv(env) {}
+      : EvaluatedExprVisitor(context), mEnv(env), mCompletion(CS_Normal),
+        mTailCall(NULL), mProfiler(NULL), mNumNodes(0) {}
   virtual ~InterpreterVisitor() {}
 
-  virtual void VisitIntegerLiteral(IntegerLiteral *literal) {
-    mEnv->literal(literal);
-  }
-  virtual void VisitBinaryOperator(BinaryOperator *bop) {
-    VisitStmt(bop);
-    mEnv->binop(bop);
-  }
-  virtual void VisitUnaryOperator(UnaryOperator *uop) {
-    VisitStmt(uop);
-    mEnv->unaryop(uop);
-  }
-  virtual void VisitDeclRefExpr(DeclRefExpr *expr) {
-    VisitStmt(expr);
-    mEnv->declref(expr);
-  }
+  // Constant expressions were folded by Environment::prepare and are not
+  // scheduled; their values are read from the side table.
+  void VisitStmt(Stmt *stmt) {}
+  virtual void VisitBinaryOperator(BinaryOperator *bop) { mEnv->binop(bop); }
+  virtual void VisitUnaryOperator(UnaryOperator *uop) { mEnv->unaryop(uop); }
+  virtual void VisitDeclRefExpr(DeclRefExpr *expr) { mEnv->declref(expr); }
   virtual void VisitArraySubscriptExpr(ArraySubscriptExpr *arrayexpr) {
-    VisitStmt(arrayexpr);
     mEnv->array(arrayexpr);
   }
   virtual void VisitParenExpr(ParenExpr *parenexpr) {
-    VisitStmt(parenexpr);
     mEnv->paren(parenexpr);
   }
-  virtual void VisitCastExpr(CastExpr *expr) {
-    VisitStmt(expr);
-    mEnv->cast(expr);
-  }
+  virtual void VisitCastExpr(CastExpr *expr) { mEnv->cast(expr); }
   virtual void VisitCallExpr(CallExpr *call) {
-    VisitStmt(call);
-    if (mEnv->builtinFunc(call)) {
-      // No need to do extra work.
+    const CallSite &site = mEnv->getCallSite(call);
+    if (site.builtin != BK_None) {
+      mEnv->builtinFunc(site);
+    } else if (site.tail) {
+      // Finish the caller and let `finishCall` continue with the callee in
+      // the same frame.
+      mEnv->tailCall(site);
+      mTailCall = &site;
+      mCompletion = CS_Return;
+    } else if (mEnv->memoLookup(site)) {
+      // Answered by an earlier call with the same arguments.
     } else {
-      mEnv->enterFunc(call);
-      try {
-        VisitStmt(call->getDirectCallee()->getBody());
-      } catch (ReturnException e) {
-        // printf("debug a function is successfully processed\n");
+      mEnv->enterFunc(site);
+      enter(site.callee, site.body, &site);
+    }
+  }
+  virtual void VisitDeclStmt(DeclStmt *declstmt) { mEnv->decl(declstmt); }
+
+  // Runs `body` of `function`, and the body of each function it tail-calls
+  // in turn, in the StackFrame on top of the Environment.
+  void runBody(FunctionDecl *function, Stmt *body) {
+    size_t bottom = mTasks.size();
+    enter(function, body, NULL);
+    run(bottom);
+  }
+  // Evaluate a global initializer.
+  void evaluate(Expr *expr) {
+    size_t bottom = mTasks.size();
+    push(expr);
+    run(bottom);
+  }
+
+  // Count statements and time calls in `profiler` from now on.
+  void setProfiler(Profiler *profiler) { mProfiler = profiler; }
+
+  void printStats(llvm::raw_ostream &os) const {
+    os << "eval: nodes " << mNumNodes << "\n";
+  }
+
+private:
+  // Step the top task until only `bottom` tasks are left.
+  void run(size_t bottom) {
+    while (mTasks.size() > bottom) {
+      step();
+      if (mCompletion != CS_Normal)
+        unwind();
+    }
+  }
+
+  void step() {
+    Task &task = mTasks.back();
+    if (task.kind == TK_Expr) {
+      stepExpr();
+      return;
+    }
+    if (task.kind == TK_Call) {
+      // The body ended without a return statement.
+      mCompletion = CS_Return;
+      return;
+    }
+    Stmt *stmt = task.stmt;
+    switch (stmt->getStmtClass()) {
+    case Stmt::CompoundStmtClass:
+      return stepBlock(cast<CompoundStmt>(stmt));
+    case Stmt::IfStmtClass: {
+      IfStmt *ifstmt = cast<IfStmt>(stmt);
+      if (!task.pos) {
+        task.pos = 1;
+        if (!push(ifstmt->getCond()))
+          return;
+      }
+      mTasks.pop_back();
+      if (mEnv->getExprValue(ifstmt->getCond()))
+        runStmt(ifstmt->getThen());
+      else if (Stmt *elseStmt = ifstmt->getElse())
+        runStmt(elseStmt);
+      return;
+    }
+    case Stmt::WhileStmtClass: {
+      WhileStmt *whilestmt = cast<WhileStmt>(stmt);
+      return stepLoop(NULL, whilestmt->getCond(), NULL, whilestmt->getBody());
+    }
+    case Stmt::ForStmtClass: {
+      ForStmt *forstmt = cast<ForStmt>(stmt);
+      if (task.loop)
+        return stepCountedLoop(forstmt, *task.loop);
+      return stepLoop(forstmt->getInit(), forstmt->getCond(),
+                      forstmt->getInc(), forstmt->getBody());
+    }
+    case Stmt::ReturnStmtClass: {
+      ReturnStmt *ret = cast<ReturnStmt>(stmt);
+      Expr *retexpr = ret->getRetValue();
+      if (!task.pos && retexpr) {
+        task.pos = 1;
+        // A tail call sets the return value itself.
+        CallExpr *call = mEnv->getTailCall(ret);
+        if (!push(call ? call : retexpr))
+          return;
       }
-      mEnv->exitFunc(call);
+      if (retexpr)
+        mEnv->returnStmt(retexpr);
+      mCompletion = CS_Return;
+      return;
+    }
+    default:
+      mTasks.pop_back();
     }
   }
-  virtual void VisitReturnStmt(ReturnStmt *ret) {
-    VisitStmt(ret);
-    mEnv->returnStmt(ret->getRetValue());
-    throw ReturnException();
+
+  // Evaluate the schedule of the top task until it ends or a call has to
+  // run first. True if it ended.
+  bool stepExpr() {
+    size_t index = mTasks.size() - 1;
+    unsigned pos = mTasks[index].pos;
+    unsigned end = mTasks[index].end;
+    while (pos < end) {
+      mNumNodes++;
+      Visit(mSchedule[pos++]);
+      if (mTasks.size() != index + 1 || mCompletion != CS_Normal) {
+        mTasks[index].pos = pos;
+        return false;
+      }
+    }
+    mTasks.pop_back();
+    return true;
   }
-  virtual void VisitUnaryExprOrTypeTraitExpr(UnaryExprOrTypeTraitExpr *expr) {
-    mEnv->ueot(expr);
+
+  // Run the statements of a block in turn, as long as they end in place.
+  void stepBlock(CompoundStmt *compound) {
+    size_t index = mTasks.size() - 1;
+    for (;;) {
+      unsigned pos = mTasks[index].pos;
+      if (pos == compound->size()) {
+        mTasks.pop_back();
+        return;
+      }
+      Stmt *next = compound->body_begin()[pos];
+      mTasks[index].pos = pos + 1;
+      // The block has nothing left to do once its last statement starts.
+      if (pos + 1 == compound->size()) {
+        mTasks.pop_back();
+        runStmt(next);
+        return;
+      }
+      if (!runStmt(next))
+        return;
+    }
   }
-  virtual void VisitDeclStmt(DeclStmt *declstmt) {
-    VisitStmt(declstmt);
-    mEnv->decl(declstmt);
+
+  // A loop goes from LP_Init through LP_Test, runs its body, then goes
+  // from LP_Next back to LP_Test. Its parts run in place until one has to
+  // wait for a call; pushing may move the tasks, so the loop's own task is
+  // looked up again each time.
+  void stepLoop(Stmt *init, Expr *cond, Expr *inc, Stmt *body) {
+    for (;;) {
+      Task &task = mTasks.back();
+      switch (task.pos) {
+      case LP_Init:
+        task.pos = LP_Cond;
+        if (init && !push(init))
+          return;
+        break;
+      case LP_Cond:
+        task.pos = LP_Test;
+        if (cond && !push(cond))
+          return;
+        break;
+      case LP_Test:
+        if (cond && !mEnv->getExprValue(cond)) {
+          mTasks.pop_back();
+          return;
+        }
+        task.pos = LP_Next;
+        runStmt(body);
+        return;
+      default:
+        task.pos = LP_Cond;
+        if (inc && !push(inc))
+          return;
+      }
+    }
   }
 
-  virtual void VisitIfStmt(IfStmt *ifstmt) {
-    Expr *cond = ifstmt->getCond();
-    Visit(cond);
-    if (mEnv->getExprValue(cond)) {
-      Visit(ifstmt->getThen());
-    } else {
-      if (Stmt *elseStmt = ifstmt->getElse()) {
-        Visit(elseStmt);
+  // A counted loop evaluates its bound once and steps the induction
+  // variable itself at LP_Next, without walking the condition and the
+  // increment; the body cannot assign the variable.
+  void stepCountedLoop(ForStmt *forstmt, const CountedLoop &loop) {
+    int64_t *var;
+    switch (mTasks.back().pos) {
+    case LP_Init:
+      mTasks.back().pos = LP_Cond;
+      if (forstmt->getInit() && !push(forstmt->getInit()))
+        return;
+      // Fall through.
+    case LP_Cond:
+      mTasks.back().pos = LP_Test;
+      if (!push(loop.bound))
+        return;
+      // Fall through.
+    case LP_Test:
+      mTasks.back().pos = LP_Next;
+      mTasks.back().bound = mEnv->getExprValue(loop.bound);
+      var = mEnv->getVarAddr(loop.var);
+      if (loop.idiom != LI_None &&
+          runLoopIdiom(loop, var, mTasks.back().bound)) {
+        mTasks.pop_back();
+        return;
       }
+      break;
+    default:
+      var = mEnv->getVarAddr(loop.var);
+      *var = (int64_t)((uint64_t)*var + loop.step);
     }
+    if (!compare(loop.cmp, *var, mTasks.back().bound)) {
+      mTasks.pop_back();
+      return;
+    }
+    runStmt(forstmt->getBody());
+  }
+  // Run a counted loop matching a LoopIdiom as one bulk operation, leaving
+  // `var` where the loop would. False if it has to run step by step.
+  bool runLoopIdiom(const CountedLoop &loop, int64_t *var, int64_t bound) {
+    uint64_t count;
+    if (!loop.getTripCount(*var, bound, count))
+      return false;
+    if (!count)
+      return true;
+    // The value reads no memory and calls nothing, so it is evaluated in
+    // place, and only once the body is known to run.
+    int64_t value = 0;
+    if (loop.idiom == LI_Fill) {
+      push(loop.value);
+      value = mEnv->getExprValue(loop.value);
+    }
+    int64_t first =
+        loop.step > 0 ? *var : (int64_t)((uint64_t)*var - (count - 1));
+    if (!mEnv->runLoopIdiom(loop, first, count, value))
+      return false;
+    *var = (int64_t)((uint64_t)*var + (uint64_t)loop.step * count);
+    return true;
   }
-  virtual void VisitWhileStmt(WhileStmt *whilestmt) {
-    Expr *cond = whilestmt->getCond();
-    Stmt *body = whilestmt->getBody();
-    Visit(cond);
-    while (mEnv->getExprValue(cond)) {
-      Visit(body);
-      Visit(cond);
-    }
-  }
-  virtual void VisitForStmt(ForStmt *forstmt) {
-    Stmt *init = forstmt->getInit();
-    Expr *cond = forstmt->getCond();
-    Expr *inc = forstmt->getInc();
-    Stmt *body = forstmt->getBody();
-    Visit(init);
-    Visit(cond);
-    while (mEnv->getExprValue(cond)) {
-      Visit(body);
-      if (inc) {
-        Visit(inc);
+  static bool compare(BinaryOperatorKind cmp, int64_t left, int64_t right) {
+    switch (cmp) {
+    case BO_LT:
+      return left < right;
+    case BO_LE:
+      return left <= right;
+    case BO_GT:
+      return left > right;
+    case BO_GE:
+      return left >= right;
+    default:
+      return left != right;
+    }
+  }
+
+  // Drop the tasks a completion other than CS_Normal skips, and let the
+  // construct it targets consume it.
+  void unwind() {
+    for (;;) {
+      Task &task = mTasks.back();
+      if (task.kind == TK_Call && mCompletion == CS_Return)
+        return finishCall();
+      if (task.kind == TK_Stmt && mCompletion != CS_Return &&
+          (isa<WhileStmt>(task.stmt) || isa<ForStmt>(task.stmt))) {
+        if (mCompletion == CS_Break)
+          mTasks.pop_back();
+        else
+          task.pos = LP_Next;
+        mCompletion = CS_Normal;
+        return;
       }
-      if (cond) {
-        Visit(cond);
+      mTasks.pop_back();
+    }
+  }
+
+  // Return from the function whose TK_Call task is on top, or run the
+  // callee of the tail call it made in its place.
+  void finishCall() {
+    mCompletion = CS_Normal;
+    if (const CallSite *tail = mTailCall) {
+      mTailCall = NULL;
+      if (mProfiler) {
+        mProfiler->exit();
+        mProfiler->enter(tail->callee);
       }
+      push(tail->body);
+      return;
+    }
+    const CallSite *site = mTasks.back().site;
+    mTasks.pop_back();
+    if (mProfiler)
+      mProfiler->exit();
+    // The StackFrame of the entry function stays for its result to be read.
+    if (site) {
+      mEnv->exitFunc(*site);
+      mEnv->memoStore(*site);
     }
   }
 
-private:
+  // Start `body` of `function`, whose StackFrame was entered for `site`.
+  void enter(FunctionDecl *function, Stmt *body, const CallSite *site) {
+    // The tasks count against the stack size as well as the frames.
+    if (mTasks.size() * sizeof(Task) > mEnv->getStackSize())
+      stackOverflow(mEnv->getStackLimit());
+    if (mProfiler)
+      mProfiler->enter(function);
+    Task task = {TK_Call, 0, 0, NULL, {site}, 0};
+    mTasks.push_back(task);
+    push(body);
+  }
+
+  // Run a statement of a block or the branch or body of a control statement.
+  bool runStmt(Stmt *stmt) {
+    if (mProfiler && !isa<CompoundStmt>(stmt))
+      mProfiler->count(stmt);
+    return push(stmt);
+  }
+
+  // Make `stmt` the next task. Expressions and declarations are evaluated
+  // right away, and only stay on the stack if a call suspends them; true if
+  // `stmt` is done with.
+  bool push(Stmt *stmt) {
+    Task task = {TK_Stmt, 0, 0, stmt, {NULL}, 0};
+    if (isa<Expr>(stmt) || isa<DeclStmt>(stmt)) {
+      task.kind = TK_Expr;
+      getSchedule(stmt, task.pos, task.end);
+      if (task.pos == task.end)
+        return true;
+      mTasks.push_back(task);
+      return stepExpr();
+    }
+    mNumNodes++;
+    if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt))
+      task.loop = mEnv->getCountedLoop(forstmt);
+    mTasks.push_back(task);
+    return false;
+  }
+
+  // Where the schedule of `root` starts and ends in mSchedule.
+  void getSchedule(Stmt *root, unsigned &begin, unsigned &end) {
+    llvm::DenseMap<const Stmt *, std::pair<unsigned, unsigned>>::iterator it =
+        mSchedules.find(root);
+    if (it == mSchedules.end()) {
+      unsigned first = mSchedule.size();
+      schedule(root);
+      it = mSchedules
+               .insert(std::make_pair(
+                   root, std::make_pair(first, (unsigned)mSchedule.size())))
+               .first;
+    }
+    begin = it->second.first;
+    end = it->second.second;
+  }
+  void schedule(Stmt *stmt) {
+    if (Expr *expr = dyn_cast<Expr>(stmt))
+      if (mEnv->getConstant(expr))
+        return;
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+      // The callee was resolved by Environment::prepare.
+      for (unsigned i = 0; i < call->getNumArgs(); i++)
+        schedule(call->getArg(i));
+    } else if (!isa<UnaryExprOrTypeTraitExpr>(stmt)) {
+      for (Stmt::child_iterator it = stmt->child_begin(),
+                                ie = stmt->child_end();
+           it != ie; ++it)
+        if (*it)
+          schedule(*it);
+    }
+    mSchedule.push_back(stmt);
+  }
+
   Environment *mEnv;
+  Completion mCompletion;
+  // The tail call that ended the current body.
+  const CallSite *mTailCall;
+  Profiler *mProfiler;
+  uint64_t mNumNodes;
+  std::vector<Task> mTasks;
+  // The schedules of every expression and declaration run so far, one
+  // after the other.
+  std::vector<Stmt *> mSchedule;
+  llvm::DenseMap<const Stmt *, std::pair<unsigned, unsigned>> mSchedules;
 };
 
 class InterpreterConsumer : public ASTConsumer {
 public:
-  explicit InterpreterConsumer(const ASTContext &context)
-      : mEnv(), mVisitor(context, &mEnv) {}
+  // Statistics are written to `log`.
+  explicit InterpreterConsumer(const ASTContext &context,
+                               const InterpreterOptions &options,
+                               llvm::raw_ostream &log)
+      : mEnv(options.stackSize), mVisitor(context, &mEnv), mEntryIndex(0),
+        mOptions(options), mLog(log), mResult(0) {
+    mEnv.setMemoize(options.memoize);
+    if (options.toStdout) {
+      mEnv.getIO().setOutput(STDOUT_FILENO);
+      mEnv.getIO().setPrompt(false);
+    }
+    if (!options.inputFile.empty() &&
+        !mEnv.getIO().setInput(options.inputFile.c_str())) {
+      llvm::errs() << "Cannot open input file " << options.inputFile << "\n";
+      exit(1);
+    }
+  }
 
   virtual ~InterpreterConsumer() {}
 
   virtual void HandleTranslationUnit(clang::ASTContext &Context) {
+    initialize(Context);
+    run(Context);
+  }
+
+  // Prepare the translation unit, evaluate its globals and lower it to
+  // bytecode, leaving only main to run.
+  void initialize(ASTContext &Context) {
     // TranslationUnitDecl is the top declaration context of the AST.
     TranslationUnitDecl *decl = Context.getTranslationUnitDecl();
+    mEnv.prepare(decl);
 
-    /// TODO: is there a way to remove the iteration below but also guarantee we
-    /// will finish visiting all literals before we start to process global
-    /// variables?
-    // Process global variables specifically.
+    // Process global variables specifically. Their literals were folded by
+    // `prepare`, only the rest of each initializer needs evaluating here.
     for (TranslationUnitDecl::decl_iterator i = decl->decls_begin(),
                                             e = decl->decls_end();
          i != e; ++i) {
       if (VarDecl *vdecl = dyn_cast<VarDecl>(*i)) {
         if (vdecl->hasInit()) {
-          mVisitor.Visit(vdecl->getInit());
+          mVisitor.evaluate(vdecl->getInit());
         }
       }
     }
 
     mEnv.init(decl);
 
+    if (!mOptions.treeWalk) {
+      // Lower main and its callees to bytecode once.
+      mEntryIndex =
+          BytecodeCompiler(&mEnv, &mModule).compile(mEnv.getEntry());
+      mVM.reset(new BytecodeVM(&mEnv, &mModule, mOptions.jitThreshold));
+    }
+  }
+
+  // Run main once `initialize` is done, and print statistics. A program
+  // overflowing the interpreted stack fails with status 1.
+  void run(ASTContext &Context) {
     FunctionDecl *entry = mEnv.getEntry();
-    try {
-      mVisitor.VisitStmt(entry->getBody());
-    } catch (ReturnException e) {
-      // printf("debug the main function is successfully processed\n");
+    std::unique_ptr<Profiler> profiler;
+    if (!mVM && !mOptions.profileFile.empty()) {
+      profiler.reset(new Profiler());
+      mVisitor.setProfiler(profiler.get());
+    }
+    StackLimit &limit = mEnv.getStackLimit();
+    if (!setjmp(limit.target)) {
+      limit.armed = true;
+      if (mVM) {
+        mResult = mVM->run(mEntryIndex);
+      } else {
+        mVisitor.runBody(entry, entry->getBody());
+        mResult = mEnv.getEntryResult();
+      }
+    } else {
+      // What was printed before the overflow comes first.
+      mEnv.getIO().flush();
+      mLog << "Interpreted stack overflow\n";
+      mResult = 1;
+    }
+    limit.armed = false;
+    if (profiler) {
+      mVisitor.setProfiler(NULL);
+      writeProfile(*profiler, Context.getSourceManager());
     }
+    mEnv.getIO().flush();
+    if (hasStats(mOptions))
+      mLog << "\n";
+    if (mOptions.heapStats)
+      mEnv.getHeap().printStats(mLog);
+    if (mOptions.memoStats)
+      mEnv.getMemo().printStats(mLog);
+    if (mVM && mOptions.jitStats)
+      mVM->printStats(mLog);
+    if (!mVM && mOptions.evalStats)
+      mVisitor.printStats(mLog);
   }
 
+  // Whether any statistics are printed after the program's output.
+  static bool hasStats(const InterpreterOptions &options) {
+    return options.heapStats || options.memoStats ||
+           (!options.treeWalk && options.jitStats) ||
+           (options.treeWalk && options.evalStats);
+  }
+
+  IOChannel &getIO() { return mEnv.getIO(); }
+  // The exit status of the program: what main returned, as a process would
+  // see it.
+  int getExitStatus() const { return mResult & 0xff; }
+
 private:
+  void writeProfile(const Profiler &profiler, const SourceManager &sm) {
+    std::error_code error;
+    llvm::raw_fd_ostream report(mOptions.profileFile, error,
+                                llvm::sys::fs::OF_None);
+    if (!error) {
+      profiler.writeReport(report, sm);
+      llvm::raw_fd_ostream folded(mOptions.profileFile + ".folded", error,
+                                  llvm::sys::fs::OF_None);
+      if (!error)
+        profiler.writeFolded(folded);
+    }
+    if (error)
+      mLog << "Cannot write profile: " << error.message() << "\n";
+  }
+
   Environment mEnv;
   InterpreterVisitor mVisitor;
+  BytecodeModule mModule;
+  unsigned mEntryIndex;
+  std::unique_ptr<BytecodeVM> mVM;
+  InterpreterOptions mOptions;
+  llvm::raw_ostream &mLog;
+  int64_t mResult;
 };
 
-class InterpreterClassAction : public ASTFrontendAction {
-public:
-  virtual std::unique_ptr<clang::ASTConsumer>
-  CreateASTConsumer(clang::CompilerInstance &Compiler, llvm::StringRef InFile) {
-    return std::unique_ptr<clang::ASTConsumer>(
-        new InterpreterConsumer(Compiler.getASTContext()));
+static double millisecondsSince(std::chrono::steady_clock::time_point start) {
+  return std::chrono::duration<double, std::milli>(
+             std::chrono::steady_clock::now() - start)
+      .count();
+}
+
+// Run `code`, with PRINT appending to `output` and GET reading `input` when
+// they are given, and statistics going to `log`. Returns the exit status,
+// which is 1 if `code` does not parse.
+static int runProgram(ASTCache &cache, const std::string &code,
+                      const InterpreterOptions &options,
+                      llvm::raw_ostream &log, std::string *output = NULL,
+                      const std::string *input = NULL) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool cached;
+  std::unique_ptr<ASTUnit> unit = cache.get(code, cached);
+  if (!unit || unit->getDiagnostics().hasErrorOccurred())
+    return 1;
+  double loadTime = millisecondsSince(start);
+
+  start = std::chrono::steady_clock::now();
+  InterpreterConsumer consumer(unit->getASTContext(), options, log);
+  if (output)
+    consumer.getIO().setOutput(output);
+  if (input) {
+    consumer.getIO().setInput(input->data(), input->size());
+    consumer.getIO().setPrompt(false);
   }
-};
+  consumer.HandleTranslationUnit(unit->getASTContext());
+  double runTime = millisecondsSince(start);
+
+  if (options.time) {
+    if (!InterpreterConsumer::hasStats(options))
+      log << "\n";
+    log << "time: " << (cached ? "cache-load " : "parse ");
+    // The peak resident size is the whole process's so far.
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    log << llvm::format("%.3f", loadTime) << " ms run "
+        << llvm::format("%.3f", runTime) << " ms peak-rss "
+        << (long long)usage.ru_maxrss << " KiB\n";
+  }
+  return consumer.getExitStatus();
+}
+
+// Read a "<tag> <length>\n" header and the `length` bytes after it.
+static bool readFrame(FILE *in, const char *tag, std::string &data) {
+  char word[16];
+  unsigned long len;
+  if (fscanf(in, "%15s %lu", word, &len) != 2 || strcmp(word, tag) != 0 ||
+      fgetc(in) != '\n')
+    return false;
+  data.resize(len);
+  return fread(&data[0], 1, len, in) == len;
+}
+
+// Serve requests from stdin until it ends. A request is a program and the
+// values its GET calls read:
+//   program <length>\n<source>input <length>\n<values>
+// and is answered on stdout with its exit status and PRINT output:
+//   status <code> output <length>\n<output>
+// Parsing reuses the process, and the AST cache if one is given; every
+// program runs in a fresh Environment.
+static int serve(ASTCache &cache, const InterpreterOptions &options) {
+  std::string code, input, output;
+  while (readFrame(stdin, "program", code)) {
+    if (!readFrame(stdin, "input", input)) {
+      llvm::errs() << "Malformed request\n";
+      return 1;
+    }
+    output.clear();
+    int status =
+        runProgram(cache, code, options, llvm::errs(), &output, &input);
+    printf("status %d output %lu\n", status, (unsigned long)output.size());
+    fwrite(output.data(), 1, output.size(), stdout);
+    fflush(stdout);
+  }
+  return 0;
+}
+
+// Run every .c file in `dir` on `jobs` threads, all reading GET values from
+// `input`, and print what each printed in the order of the file names.
+static int runBatch(const std::string &dir, unsigned jobs,
+                    const std::string &cacheDir,
+                    const InterpreterOptions &options,
+                    const std::string &input) {
+  struct Result {
+    std::string path;
+    int status;
+    std::string output;
+    std::string log;
+  };
+  std::vector<Result> results;
+  std::error_code error;
+  for (llvm::sys::fs::directory_iterator it(dir, error), ie;
+       it != ie && !error; it.increment(error)) {
+    if (llvm::sys::path::extension(it->path()) == ".c") {
+      Result result = {it->path(), 0, "", ""};
+      results.push_back(result);
+    }
+  }
+  if (error) {
+    llvm::errs() << "Cannot read directory " << dir << "\n";
+    return 1;
+  }
+  std::sort(results.begin(), results.end(),
+            [](const Result &a, const Result &b) { return a.path < b.path; });
+
+  // Each worker parses and runs one program at a time with its own
+  // front end and Environment, taking the next file until none is left.
+  std::atomic<size_t> next(0);
+  std::vector<std::thread> workers;
+  for (unsigned i = 0; i < jobs; i++) {
+    workers.push_back(std::thread([&]() {
+      ASTCache cache(cacheDir);
+      for (size_t n = next++; n < results.size(); n = next++) {
+        Result &result = results[n];
+        llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> code =
+            llvm::MemoryBuffer::getFile(result.path);
+        if (!code) {
+          result.status = 1;
+          result.log = "Cannot read file\n";
+          continue;
+        }
+        llvm::raw_string_ostream log(result.log);
+        result.status = runProgram(cache, (*code)->getBuffer().str(), options,
+                                   log, &result.output, &input);
+      }
+    }));
+  }
+  for (size_t i = 0; i < workers.size(); i++)
+    workers[i].join();
+
+  int failed = 0;
+  for (size_t i = 0; i < results.size(); i++) {
+    const Result &result = results[i];
+    llvm::outs() << "== " << result.path << " status " << result.status
+                 << "\n"
+                 << result.output << result.log << "\n";
+    if (result.status)
+      failed++;
+  }
+  return failed ? 1 : 0;
+}
+
+// Run main of the initialized `consumer` in a child process reading GET
+// values from `input`, so that each run starts from the same heap and
+// globals. Returns the exit status, 128 plus the signal if the child was
+// killed, and collects what it printed in `output`.
+static int runForkedChild(InterpreterConsumer &consumer, ASTContext &context,
+                          llvm::StringRef input, std::string &output) {
+  int fds[2];
+  if (pipe(fds) != 0) {
+    llvm::errs() << "Cannot create a pipe\n";
+    exit(1);
+  }
+  llvm::outs().flush();
+  pid_t pid = fork();
+  if (pid < 0) {
+    llvm::errs() << "Cannot fork\n";
+    exit(1);
+  }
+  if (pid == 0) {
+    close(fds[0]);
+    consumer.getIO().setOutput(fds[1]);
+    consumer.getIO().setInput(input.data(), input.size());
+    consumer.getIO().setPrompt(false);
+    consumer.run(context);
+    _exit(consumer.getExitStatus());
+  }
+  close(fds[1]);
+  output.clear();
+  char buf[4096];
+  ssize_t len;
+  while ((len = read(fds[0], buf, sizeof(buf))) > 0)
+    output.append(buf, len);
+  close(fds[0]);
+  int status;
+  if (waitpid(pid, &status, 0) < 0)
+    return 1;
+  return WIFEXITED(status) ? WEXITSTATUS(status) : 128 + WTERMSIG(status);
+}
+
+// Parse and initialize `code` once, then run it once for each line of
+// `inputs`, which holds the GET values of that run. Every run is forked off
+// the initialized process. Their statuses and outputs are printed in order,
+// and how many ran per second goes to stderr.
+static int runForked(ASTCache &cache, const std::string &code,
+                     const InterpreterOptions &options,
+                     const std::string &inputs) {
+  std::chrono::steady_clock::time_point start =
+      std::chrono::steady_clock::now();
+  bool cached;
+  std::unique_ptr<ASTUnit> unit = cache.get(code, cached);
+  if (!unit || unit->getDiagnostics().hasErrorOccurred())
+    return 1;
+  InterpreterConsumer consumer(unit->getASTContext(), options, llvm::errs());
+  consumer.initialize(unit->getASTContext());
+  double setupTime = millisecondsSince(start);
+
+  // A blank line is a run without GET values; only the newline ending the
+  // last line starts none.
+  llvm::SmallVector<llvm::StringRef, 64> lines;
+  llvm::StringRef(inputs).split(lines, '\n', -1, true);
+  if (lines.back().empty())
+    lines.pop_back();
+  start = std::chrono::steady_clock::now();
+  unsigned failed = 0;
+  std::string output;
+  for (size_t i = 0; i < lines.size(); i++) {
+    int status =
+        runForkedChild(consumer, unit->getASTContext(), lines[i], output);
+    llvm::outs() << "== input " << i + 1 << " status " << status << "\n"
+                 << output << "\n";
+    if (status)
+      failed++;
+  }
+  double runTime = millisecondsSince(start);
+  llvm::outs().flush();
+  llvm::errs() << "fork: runs " << lines.size() << " failed " << failed
+               << " setup " << llvm::format("%.3f", setupTime)
+               << " ms run " << llvm::format("%.3f", runTime) << " ms "
+               << llvm::format("%.1f", lines.size() * 1000.0 / runTime)
+               << " runs/s\n";
+  return failed ? 1 : 0;
+}
 
 int main(int argc, char **argv) {
-  if (argc > 1) {
-    // printf("debug start\n");
-    clang::tooling::runToolOnCode(
-        std::unique_ptr<clang::FrontendAction>(new InterpreterClassAction),
-        argv[1]);
+  llvm::cl::ParseCommandLineOptions(argc, argv, "AST interpreter\n");
+  llvm::InitializeNativeTarget();
+  llvm::InitializeNativeTargetAsmPrinter();
+  if (SourceCode.empty() && !Server && BatchDir.empty())
+    return 0;
+  InterpreterOptions options;
+  // Profiles are taken of the AST walker.
+  options.treeWalk = TreeWalk || !ProfileFile.empty();
+  options.heapStats = HeapStats;
+  options.memoize = !NoMemo;
+  options.memoStats = MemoStats;
+  options.evalStats = EvalStats;
+  options.jitThreshold = JitThreshold;
+  options.jitStats = JitStats;
+  options.profileFile = ProfileFile;
+  options.toStdout = ToStdout;
+  options.inputFile = InputFile;
+  options.time = Time;
+  options.stackSize = (size_t)StackSize << 20;
+
+  if (!BatchDir.empty()) {
+    // Every program reads the same GET values, loaded once.
+    std::string input;
+    if (!options.inputFile.empty()) {
+      llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> buffer =
+          llvm::MemoryBuffer::getFile(options.inputFile);
+      if (!buffer) {
+        llvm::errs() << "Cannot open input file " << options.inputFile
+                     << "\n";
+        return 1;
+      }
+      input = (*buffer)->getBuffer().str();
+      options.inputFile.clear();
+    }
+    unsigned jobs =
+        Jobs ? Jobs : std::max(1u, std::thread::hardware_concurrency());
+    return runBatch(BatchDir, jobs, CacheDir, options, input);
+  }
+
+  ASTCache cache(CacheDir);
+  if (Server)
+    return serve(cache, options);
+  if (!ForkInputs.empty()) {
+    llvm::ErrorOr<std::unique_ptr<llvm::MemoryBuffer>> inputs =
+        llvm::MemoryBuffer::getFile(ForkInputs);
+    if (!inputs) {
+      llvm::errs() << "Cannot open input file " << ForkInputs << "\n";
+      return 1;
+    }
+    // Each run reads its own line instead.
+    options.inputFile.clear();
+    return runForked(cache, SourceCode, options,
+                     (*inputs)->getBuffer().str());
   }
+  return runProgram(cache, SourceCode, options, llvm::errs());
 }
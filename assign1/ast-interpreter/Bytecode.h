@@ -0,0 +1,1090 @@
+//==--- Bytecode.h - Register bytecode compiler and VM for the interpreter ===//
+//===----------------------------------------------------------------------===//
+#include "Environment.h"
+
+// Every value is an int64_t living in a register of the current frame.
+// Memory holds words, except that characters take a byte, which the B and UB
+// variants load sign- or zero-extended and store truncated. Jump targets are
+// instruction indices inside the same function; jumps closing a loop have c
+// set.
+enum Opcode {
+  OP_Const,       // R[a] = imm
+  OP_Mov,         // R[a] = R[b]
+  OP_Add,         // R[a] = R[b] + R[c]
+  OP_Sub,         // R[a] = R[b] - R[c]
+  OP_Mul,         // R[a] = R[b] * R[c]
+  OP_Div,         // R[a] = R[b] / R[c]
+  OP_EQ,          // R[a] = R[b] == R[c]
+  OP_NE,          // R[a] = R[b] != R[c]
+  OP_LT,          // R[a] = R[b] < R[c]
+  OP_GT,          // R[a] = R[b] > R[c]
+  OP_LE,          // R[a] = R[b] <= R[c]
+  OP_GE,          // R[a] = R[b] >= R[c]
+  OP_AddImm,      // R[a] = R[b] + imm
+  OP_PtrAdd,      // R[a] = R[b] + R[c] * sizeof(int64_t)
+  OP_PtrSub,      // R[a] = R[b] - R[c] * sizeof(int64_t)
+  OP_Neg,         // R[a] = -R[b]
+  OP_Not,         // R[a] = ~R[b]
+  OP_LNot,        // R[a] = !R[b]
+  OP_SExtB,       // R[a] = (int8_t)R[b]
+  OP_ZExtB,       // R[a] = (uint8_t)R[b]
+  OP_Load,        // R[a] = *(int64_t *)R[b]
+  OP_LoadB,       // R[a] = *(int8_t *)R[b]
+  OP_LoadUB,      // R[a] = *(uint8_t *)R[b]
+  OP_Store,       // *(int64_t *)R[a] = R[b]
+  OP_StoreB,      // *(int8_t *)R[a] = R[b]
+  OP_LoadIdx,     // R[a] = ((int64_t *)R[b])[R[c]]
+  OP_LoadIdxB,    // R[a] = ((int8_t *)R[b])[R[c]]
+  OP_LoadIdxUB,   // R[a] = ((uint8_t *)R[b])[R[c]]
+  OP_StoreIdx,    // ((int64_t *)R[a])[R[b]] = R[c]
+  OP_StoreIdxB,   // ((int8_t *)R[a])[R[b]] = R[c]
+  OP_LoadGlobal,  // R[a] = *(int64_t *)imm
+  OP_StoreGlobal, // *(int64_t *)imm = R[b]
+  OP_Alloca,      // R[a] = frame arrays + imm words, with b words zeroed
+  OP_Jmp,         // goto imm
+  OP_Jz,          // if (!R[a]) goto imm
+  OP_Jnz,         // if (R[a]) goto imm
+  OP_JEQ,         // if (R[a] == R[b]) goto imm
+  OP_JNE,         // if (R[a] != R[b]) goto imm
+  OP_JLT,         // if (R[a] < R[b]) goto imm
+  OP_JGT,         // if (R[a] > R[b]) goto imm
+  OP_JLE,         // if (R[a] <= R[b]) goto imm
+  OP_JGE,         // if (R[a] >= R[b]) goto imm
+  OP_Call,        // R[a] = functions[b](R[c], ..., R[c + imm - 1])
+  OP_TailCall,    // return functions[b](R[c], ..., R[c + imm - 1])
+  OP_Input,       // R[a] = GET()
+  OP_Output,      // PRINT(R[b])
+  OP_Malloc,      // R[a] = MALLOC(R[b])
+  OP_Free,        // FREE(R[b])
+  OP_Ret,         // return R[a]
+  OP_RetImm       // return imm
+};
+
+struct Instr {
+  Opcode op;
+  unsigned a, b, c;
+  int64_t imm;
+};
+
+// A function lowered to bytecode. Parameters occupy registers [0, numParams)
+// and `consts` are written into their registers when the frame is created.
+// Each frame also reserves `numArrayWords` words for its local arrays.
+struct BytecodeFunction {
+  FunctionDecl *decl;
+  std::vector<Instr> code;
+  std::vector<std::pair<unsigned, int64_t>> consts;
+  unsigned numParams;
+  unsigned numRegs;
+  unsigned numArrayWords;
+  // Calls to the function are memoized.
+  bool pure;
+};
+
+struct BytecodeModule {
+  std::vector<BytecodeFunction> functions;
+  std::map<FunctionDecl *, unsigned> indices;
+};
+
+// Lowers the bodies of `main` and every function reachable from it.
+class BytecodeCompiler {
+  Environment *mEnv;
+  BytecodeModule *mModule;
+  std::vector<unsigned> mWorklist;
+  // State of the function being compiled.
+  BytecodeFunction mFunc;
+  std::map<Decl *, unsigned> mLocals;
+  std::map<int64_t, unsigned> mConsts;
+  unsigned mNextReg;
+
+  // Where an assignment writes to, and what it holds.
+  struct LValue {
+    enum Kind { LV_Reg, LV_Global, LV_Mem, LV_Index } kind;
+    unsigned reg, index;
+    int64_t addr;
+    MemKind mem;
+  };
+
+public:
+  BytecodeCompiler(Environment *env, BytecodeModule *module)
+      : mEnv(env), mModule(module), mNextReg(0) {}
+
+  // Compile `entry` and its callees, returning the index of `entry`.
+  unsigned compile(FunctionDecl *entry) {
+    unsigned index = getFunctionIndex(entry);
+    while (!mWorklist.empty()) {
+      unsigned next = mWorklist.back();
+      mWorklist.pop_back();
+      compileFunction(next);
+    }
+    return index;
+  }
+
+private:
+  // Map a callee to its slot in the module, queueing it for compilation the
+  // first time it is seen. Calls through a prototype resolve to the body.
+  unsigned getFunctionIndex(FunctionDecl *callee) {
+    FunctionDecl *def = callee->getDefinition();
+    if (!def) {
+      llvm::errs() << "Undefined function " << callee->getName() << "\n";
+      assert(false);
+    }
+    std::map<FunctionDecl *, unsigned>::iterator it =
+        mModule->indices.find(def);
+    if (it != mModule->indices.end())
+      return it->second;
+    unsigned index = mModule->functions.size();
+    BytecodeFunction func;
+    func.decl = def;
+    func.numParams = def->getNumParams();
+    func.numRegs = 0;
+    func.numArrayWords = 0;
+    func.pure = mEnv->isPure(def);
+    mModule->functions.push_back(func);
+    mModule->indices[def] = index;
+    mWorklist.push_back(index);
+    return index;
+  }
+
+  void compileFunction(unsigned index) {
+    mFunc = mModule->functions[index];
+    mLocals.clear();
+    mConsts.clear();
+    mNextReg = 0;
+    FunctionDecl *fdecl = mFunc.decl;
+    for (unsigned i = 0; i < fdecl->getNumParams(); i++)
+      mLocals[fdecl->getParamDecl(i)] = newReg();
+    compileStmt(fdecl->getBody());
+    emit(OP_RetImm, 0, 0, 0, 0);
+    placeConsts();
+    mModule->functions[index] = mFunc;
+  }
+
+  unsigned newReg() {
+    unsigned reg = mNextReg++;
+    if (mNextReg > mFunc.numRegs)
+      mFunc.numRegs = mNextReg;
+    return reg;
+  }
+
+  // Constants live in registers that are filled once per call. While the
+  // function is compiled they are numbered from CONST_BASE, and
+  // `placeConsts` moves them above all other registers afterwards.
+  static const unsigned CONST_BASE = 1u << 30;
+  unsigned constReg(int64_t val) {
+    std::map<int64_t, unsigned>::iterator it = mConsts.find(val);
+    if (it != mConsts.end())
+      return it->second;
+    unsigned reg = CONST_BASE + mFunc.consts.size();
+    mConsts[val] = reg;
+    mFunc.consts.push_back(std::make_pair(reg, val));
+    return reg;
+  }
+  void placeConsts() {
+    unsigned offset = mFunc.numRegs - CONST_BASE;
+    for (size_t i = 0; i < mFunc.code.size(); i++) {
+      Instr &instr = mFunc.code[i];
+      if (instr.a >= CONST_BASE)
+        instr.a += offset;
+      if (instr.b >= CONST_BASE)
+        instr.b += offset;
+      if (instr.c >= CONST_BASE)
+        instr.c += offset;
+    }
+    for (size_t i = 0; i < mFunc.consts.size(); i++)
+      mFunc.consts[i].first += offset;
+    mFunc.numRegs += mFunc.consts.size();
+  }
+
+  size_t emit(Opcode op, unsigned a, unsigned b, unsigned c, int64_t imm) {
+    Instr instr = {op, a, b, c, imm};
+    mFunc.code.push_back(instr);
+    return mFunc.code.size() - 1;
+  }
+  size_t here() { return mFunc.code.size(); }
+  void patch(const std::vector<size_t> &jumps, size_t target) {
+    for (size_t i = 0; i < jumps.size(); i++)
+      mFunc.code[jumps[i]].imm = target;
+  }
+
+  void compileStmt(Stmt *stmt) {
+    if (!stmt)
+      return;
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+      unsigned mark = mNextReg;
+      for (CompoundStmt::body_iterator it = compound->body_begin(),
+                                       ie = compound->body_end();
+           it != ie; ++it)
+        compileStmt(*it);
+      release(mark);
+    } else if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+      compileDecl(declstmt);
+    } else if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt)) {
+      std::vector<size_t> toElse;
+      compileCond(ifstmt->getCond(), false, toElse);
+      compileStmt(ifstmt->getThen());
+      if (Stmt *elseStmt = ifstmt->getElse()) {
+        size_t toEnd = emit(OP_Jmp, 0, 0, 0, 0);
+        patch(toElse, here());
+        compileStmt(elseStmt);
+        mFunc.code[toEnd].imm = here();
+      } else {
+        patch(toElse, here());
+      }
+    } else if (WhileStmt *whilestmt = dyn_cast<WhileStmt>(stmt)) {
+      compileLoop(whilestmt->getCond(), whilestmt->getBody(), NULL);
+    } else if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt)) {
+      unsigned mark = mNextReg;
+      compileStmt(forstmt->getInit());
+      compileLoop(forstmt->getCond(), forstmt->getBody(), forstmt->getInc());
+      release(mark);
+    } else if (ReturnStmt *ret = dyn_cast<ReturnStmt>(stmt)) {
+      if (CallExpr *call = mEnv->getTailCall(ret)) {
+        unsigned mark = mNextReg;
+        compileCall(call, -1, true);
+        release(mark);
+      } else if (Expr *retexpr = ret->getRetValue()) {
+        unsigned mark = mNextReg;
+        emit(OP_Ret, compileExpr(retexpr), 0, 0, 0);
+        release(mark);
+      } else {
+        emit(OP_RetImm, 0, 0, 0, 0);
+      }
+    } else if (isa<NullStmt>(stmt)) {
+      // Nothing to do.
+    } else if (Expr *expr = dyn_cast<Expr>(stmt)) {
+      unsigned mark = mNextReg;
+      CallExpr *call = dyn_cast<CallExpr>(expr);
+      if (call && mEnv->isTailCall(call))
+        compileCall(call, -1, true);
+      else
+        compileExpr(expr);
+      release(mark);
+    } else {
+      llvm::errs() << "Unsupported statement in bytecode compiler\n";
+      stmt->dump();
+      assert(false);
+    }
+  }
+
+  // Loops are rotated so that each iteration runs a single conditional jump:
+  //   jmp cond; body: <body> <inc>; cond: if (<cond>) goto body
+  void compileLoop(Expr *cond, Stmt *body, Expr *inc) {
+    size_t toCond = emit(OP_Jmp, 0, 0, 0, 0);
+    size_t bodyStart = here();
+    compileStmt(body);
+    if (inc)
+      compileStmt(inc);
+    mFunc.code[toCond].imm = here();
+    std::vector<size_t> toBody;
+    if (cond)
+      compileCond(cond, true, toBody);
+    else
+      toBody.push_back(emit(OP_Jmp, 0, 0, 0, 0));
+    patch(toBody, bodyStart);
+    for (size_t i = 0; i < toBody.size(); i++)
+      mFunc.code[toBody[i]].c = 1;
+  }
+
+  // Emit jumps taken when `cond` evaluates to `jumpIf`, recording them in
+  // `jumps` to be patched by the caller. Comparisons fuse into the branch.
+  void compileCond(Expr *cond, bool jumpIf, std::vector<size_t> &jumps) {
+    // A constant condition is either an unconditional jump or none.
+    if (const int64_t *val = mEnv->getConstant(cond)) {
+      if ((*val != 0) == jumpIf)
+        jumps.push_back(emit(OP_Jmp, 0, 0, 0, 0));
+      return;
+    }
+    unsigned mark = mNextReg;
+    cond = cond->IgnoreParens();
+    if (ImplicitCastExpr *castexpr = dyn_cast<ImplicitCastExpr>(cond)) {
+      if (castexpr->getCastKind() == CK_IntegralToBoolean ||
+          castexpr->getCastKind() == CK_PointerToBoolean)
+        cond = castexpr->getSubExpr()->IgnoreParens();
+    }
+    BinaryOperator *bop = dyn_cast<BinaryOperator>(cond);
+    if (bop && bop->isComparisonOp()) {
+      unsigned left = compileExpr(bop->getLHS());
+      unsigned right = compileExpr(bop->getRHS());
+      BinaryOperatorKind opc = bop->getOpcode();
+      if (!jumpIf)
+        opc = invertComparison(opc);
+      jumps.push_back(emit(branchOpcode(opc), left, right, 0, 0));
+    } else {
+      unsigned val = compileExpr(cond);
+      jumps.push_back(emit(jumpIf ? OP_Jnz : OP_Jz, val, 0, 0, 0));
+    }
+    release(mark);
+  }
+
+  static BinaryOperatorKind invertComparison(BinaryOperatorKind opc) {
+    switch (opc) {
+    case BO_EQ:
+      return BO_NE;
+    case BO_NE:
+      return BO_EQ;
+    case BO_LT:
+      return BO_GE;
+    case BO_GE:
+      return BO_LT;
+    case BO_GT:
+      return BO_LE;
+    default:
+      return BO_GT;
+    }
+  }
+  static Opcode branchOpcode(BinaryOperatorKind opc) {
+    switch (opc) {
+    case BO_EQ:
+      return OP_JEQ;
+    case BO_NE:
+      return OP_JNE;
+    case BO_LT:
+      return OP_JLT;
+    case BO_GT:
+      return OP_JGT;
+    case BO_LE:
+      return OP_JLE;
+    default:
+      return OP_JGE;
+    }
+  }
+
+  void compileDecl(DeclStmt *declstmt) {
+    for (DeclStmt::decl_iterator it = declstmt->decl_begin(),
+                                 ie = declstmt->decl_end();
+         it != ie; ++it) {
+      VarDecl *vardecl = dyn_cast<VarDecl>(*it);
+      if (!vardecl)
+        continue;
+      QualType type = vardecl->getType();
+      unsigned reg = newReg();
+      mLocals[vardecl] = reg;
+      unsigned mark = mNextReg;
+      if (type->isIntegerType() || type->isPointerType()) {
+        if (vardecl->hasInit())
+          compileExpr(vardecl->getInit(), reg);
+        else
+          emit(OP_Const, reg, 0, 0, 0);
+      } else if (isa<ConstantArrayType>(type.getTypePtr())) {
+        unsigned words =
+            (getTypeWidth(type) + sizeof(int64_t) - 1) / sizeof(int64_t);
+        emit(OP_Alloca, reg, words, 0, mFunc.numArrayWords);
+        mFunc.numArrayWords += words;
+      } else {
+        llvm::errs() << "Unsupported decl type in bytecode compiler\n";
+        declstmt->dump();
+        type->dump();
+        assert(false);
+      }
+      release(mark);
+    }
+  }
+
+  // Registers allocated after `mark` held temporaries that are now dead.
+  void release(unsigned mark) { mNextReg = mark; }
+
+  // Compile `expr` and return the register holding its value. If `dst` is
+  // given the value is computed straight into that register.
+  unsigned compileExpr(Expr *expr, int dst = -1) {
+    // Literals, `sizeof` and whatever folds down to them.
+    if (const int64_t *val = mEnv->getConstant(expr))
+      return move(constReg(*val), dst);
+    if (ParenExpr *paren = dyn_cast<ParenExpr>(expr))
+      return compileExpr(paren->getSubExpr(), dst);
+    if (CastExpr *castexpr = dyn_cast<CastExpr>(expr)) {
+      // Conversions to characters keep the low byte.
+      MemKind kind = getMemKind(castexpr->getType());
+      if (castexpr->getCastKind() != CK_IntegralCast || kind == MK_Word)
+        return compileExpr(castexpr->getSubExpr(), dst);
+      unsigned val = compileExpr(castexpr->getSubExpr());
+      unsigned result = target(dst);
+      emit(kind == MK_Byte ? OP_SExtB : OP_ZExtB, result, val, 0, 0);
+      return result;
+    }
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr))
+      return load(declRefLValue(declref), dst);
+    if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr))
+      return load(compileLValue(array), dst);
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr))
+      return compileUnary(uop, dst);
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+      return compileBinary(bop, dst);
+    if (CallExpr *call = dyn_cast<CallExpr>(expr))
+      return compileCall(call, dst);
+    llvm::errs() << "Unsupported expression in bytecode compiler\n";
+    expr->dump();
+    assert(false);
+    return 0;
+  }
+
+  unsigned target(int dst) { return dst >= 0 ? (unsigned)dst : newReg(); }
+  unsigned move(unsigned reg, int dst) {
+    if (dst < 0 || (unsigned)dst == reg)
+      return reg;
+    emit(OP_Mov, dst, reg, 0, 0);
+    return dst;
+  }
+
+  LValue declRefLValue(DeclRefExpr *declref) {
+    Decl *decl = declref->getFoundDecl();
+    LValue lv;
+    lv.mem = getMemKind(declref->getType());
+    std::map<Decl *, unsigned>::iterator it = mLocals.find(decl);
+    if (it != mLocals.end()) {
+      lv.kind = LValue::LV_Reg;
+      lv.reg = it->second;
+    } else if (int64_t *addr = mEnv->getGlobalAddr(decl)) {
+      lv.kind = LValue::LV_Global;
+      lv.addr = reinterpret_cast<int64_t>(addr);
+    } else {
+      llvm::errs() << "Undefined variable in bytecode compiler\n";
+      declref->dump();
+      assert(false);
+    }
+    return lv;
+  }
+
+  LValue compileLValue(Expr *expr) {
+    expr = expr->IgnoreParens();
+    LValue lv;
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+      lv = declRefLValue(declref);
+    } else if (ArraySubscriptExpr *array = dyn_cast<ArraySubscriptExpr>(expr)) {
+      lv.kind = LValue::LV_Index;
+      lv.reg = compileExpr(array->getBase());
+      lv.index = compileExpr(array->getIdx());
+      lv.mem = getMemKind(array->getType());
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+      assert(uop->getOpcode() == UO_Deref);
+      lv.kind = LValue::LV_Mem;
+      lv.reg = compileExpr(uop->getSubExpr());
+      lv.mem = getMemKind(uop->getType());
+    } else {
+      llvm::errs() << "Unsupported left value type in bytecode compiler\n";
+      expr->dump();
+      assert(false);
+    }
+    return lv;
+  }
+
+  unsigned load(const LValue &lv, int dst) {
+    if (lv.kind == LValue::LV_Reg)
+      return move(lv.reg, dst);
+    unsigned reg = target(dst);
+    // Indexed by [kind][indexed].
+    static const Opcode loads[3][2] = {{OP_Load, OP_LoadIdx},
+                                       {OP_LoadB, OP_LoadIdxB},
+                                       {OP_LoadUB, OP_LoadIdxUB}};
+    if (lv.kind == LValue::LV_Global)
+      emit(OP_LoadGlobal, reg, 0, 0, lv.addr);
+    else if (lv.kind == LValue::LV_Mem)
+      emit(loads[lv.mem][0], reg, lv.reg, 0, 0);
+    else
+      emit(loads[lv.mem][1], reg, lv.reg, lv.index, 0);
+    return reg;
+  }
+  void store(const LValue &lv, unsigned val) {
+    bool word = lv.mem == MK_Word;
+    if (lv.kind == LValue::LV_Reg)
+      move(val, lv.reg);
+    else if (lv.kind == LValue::LV_Global)
+      emit(OP_StoreGlobal, 0, val, 0, lv.addr);
+    else if (lv.kind == LValue::LV_Mem)
+      emit(word ? OP_Store : OP_StoreB, lv.reg, val, 0, 0);
+    else
+      emit(word ? OP_StoreIdx : OP_StoreIdxB, lv.reg, lv.index, val, 0);
+  }
+
+  unsigned compileUnary(UnaryOperator *uop, int dst) {
+    UnaryOperatorKind opc = uop->getOpcode();
+    if (opc == UO_Deref) {
+      LValue lv;
+      lv.kind = LValue::LV_Mem;
+      lv.reg = compileExpr(uop->getSubExpr());
+      lv.mem = getMemKind(uop->getType());
+      return load(lv, dst);
+    }
+    if (uop->isIncrementDecrementOp()) {
+      // Pointers step by the size of what they point to.
+      int64_t step = uop->getType()->isPointerType()
+                         ? getPointeeWidth(uop->getType())
+                         : 1;
+      if (uop->isDecrementOp())
+        step = -step;
+      LValue lv = compileLValue(uop->getSubExpr());
+      unsigned old = load(lv, -1);
+      unsigned result;
+      if (uop->isPrefix()) {
+        result = target(dst);
+        emit(OP_AddImm, result, old, 0, step);
+        narrowReg(result, lv.mem);
+        store(lv, result);
+      } else {
+        result = target(dst);
+        emit(OP_Mov, result, old, 0, 0);
+        unsigned updated = lv.kind == LValue::LV_Reg ? lv.reg : newReg();
+        emit(OP_AddImm, updated, old, 0, step);
+        narrowReg(updated, lv.mem);
+        store(lv, updated);
+      }
+      return result;
+    }
+    unsigned val = compileExpr(uop->getSubExpr());
+    if (opc == UO_Plus)
+      return move(val, dst);
+    unsigned result = target(dst);
+    if (opc == UO_Minus)
+      emit(OP_Neg, result, val, 0, 0);
+    else if (opc == UO_Not)
+      emit(OP_Not, result, val, 0, 0);
+    else if (opc == UO_LNot)
+      emit(OP_LNot, result, val, 0, 0);
+    else {
+      llvm::errs() << "Unsupported operation in bytecode compiler\n";
+      uop->dump();
+      assert(false);
+    }
+    return result;
+  }
+
+  unsigned compileBinary(BinaryOperator *bop, int dst) {
+    Expr *left = bop->getLHS();
+    Expr *right = bop->getRHS();
+    if (bop->getOpcode() == BO_Assign) {
+      LValue lv = compileLValue(left);
+      if (lv.kind == LValue::LV_Reg) {
+        compileExpr(right, lv.reg);
+        return move(lv.reg, dst);
+      }
+      unsigned val = compileExpr(right, dst);
+      store(lv, val);
+      return val;
+    }
+    unsigned leftReg = compileExpr(left);
+    unsigned rightReg = compileExpr(right);
+    unsigned result = target(dst);
+    BinaryOperatorKind opc = bop->getOpcode();
+    // In `*a+1` situation, the unit movement distance is sizeof(int64_t).
+    // Pointers to characters move by bytes, like integers.
+    bool leftWords = isWordPointer(left->getType());
+    bool rightWords = isWordPointer(right->getType());
+    if (leftWords && right->getType()->isIntegerType()) {
+      assert(opc == BO_Add || opc == BO_Sub);
+      emit(opc == BO_Add ? OP_PtrAdd : OP_PtrSub, result, leftReg, rightReg, 0);
+      return result;
+    }
+    if (left->getType()->isIntegerType() && rightWords) {
+      assert(opc == BO_Add);
+      emit(OP_PtrAdd, result, rightReg, leftReg, 0);
+      return result;
+    }
+    if (leftWords && rightWords && opc == BO_Sub) {
+      emit(OP_Sub, result, leftReg, rightReg, 0);
+      emit(OP_Div, result, result, constReg(sizeof(int64_t)), 0);
+      return result;
+    }
+    Opcode op;
+    switch (opc) {
+    case BO_Add:
+      op = OP_Add;
+      break;
+    case BO_Sub:
+      op = OP_Sub;
+      break;
+    case BO_Mul:
+      op = OP_Mul;
+      break;
+    case BO_Div:
+      op = OP_Div;
+      break;
+    case BO_EQ:
+      op = OP_EQ;
+      break;
+    case BO_NE:
+      op = OP_NE;
+      break;
+    case BO_LT:
+      op = OP_LT;
+      break;
+    case BO_GT:
+      op = OP_GT;
+      break;
+    case BO_LE:
+      op = OP_LE;
+      break;
+    case BO_GE:
+      op = OP_GE;
+      break;
+    default:
+      llvm::errs() << "Unsupported operation in bytecode compiler\n";
+      bop->dump();
+      assert(false);
+      op = OP_Add;
+    }
+    emit(op, result, leftReg, rightReg, 0);
+    return result;
+  }
+
+  // Convert `reg` in place to a value of kind `mem`.
+  void narrowReg(unsigned reg, MemKind mem) {
+    if (mem != MK_Word)
+      emit(mem == MK_Byte ? OP_SExtB : OP_ZExtB, reg, reg, 0, 0);
+  }
+
+  // A tail call returns whatever the callee returns.
+  unsigned compileCall(CallExpr *call, int dst, bool tail = false) {
+    FunctionDecl *callee = call->getDirectCallee();
+    BuiltinKind kind = mEnv->getBuiltinKind(callee);
+    if (kind != BK_None) {
+      unsigned arg = kind == BK_Input ? 0 : compileExpr(call->getArg(0));
+      unsigned result = target(dst);
+      switch (kind) {
+      case BK_Input:
+        emit(OP_Input, result, 0, 0, 0);
+        break;
+      case BK_Output:
+        emit(OP_Output, 0, arg, 0, 0);
+        break;
+      case BK_Malloc:
+        emit(OP_Malloc, result, arg, 0, 0);
+        break;
+      default:
+        emit(OP_Free, 0, arg, 0, 0);
+        break;
+      }
+      return result;
+    }
+    // Arguments are evaluated into consecutive registers, which the callee
+    // sees as its parameters.
+    unsigned numArgs = call->getNumArgs();
+    unsigned base = mNextReg;
+    for (unsigned i = 0; i < numArgs; i++)
+      newReg();
+    for (unsigned i = 0; i < numArgs; i++)
+      compileExpr(call->getArg(i), base + i);
+    if (tail) {
+      emit(OP_TailCall, 0, getFunctionIndex(callee), base, numArgs);
+      return 0;
+    }
+    unsigned result = target(dst);
+    emit(OP_Call, result, getFunctionIndex(callee), base, numArgs);
+    return result;
+  }
+};
+
+#include "Jit.h"
+
+// Executes a BytecodeModule. Frames are kept on an explicit stack, so
+// interpreted calls do not recurse on the native stack.
+//
+// Functions that get hot, counting calls and loop iterations, are compiled
+// to native code. Later calls go to that code, and a frame spinning in a
+// loop moves into it at the loop head.
+class BytecodeVM {
+  // Native calls nest at most this deep; deeper calls are interpreted.
+  static const unsigned MAX_NATIVE_DEPTH = 2048;
+
+  Environment *mEnv;
+  BytecodeModule *mModule;
+  std::vector<int64_t> mRegs;
+  // The registers above the frame that last called native code, where
+  // calls back into the interpreter put their frames.
+  size_t mTop;
+  // Local arrays of the frames, released in bulk when a frame returns.
+  FrameArena mArrays;
+
+  struct Frame {
+    const BytecodeFunction *func;
+    const Instr *pc;
+    size_t base;
+    unsigned dst;
+    int64_t *arrays;
+    // The result of the call this frame waits for goes to the MemoTable.
+    bool memo;
+  };
+  std::vector<Frame> mFrames;
+
+  // A memoized call in progress.
+  struct MemoKey {
+    const FunctionDecl *function;
+    int64_t args[MEMO_MAX_ARGS];
+  };
+  std::vector<MemoKey> mMemoKeys;
+
+  // Calls and loop iterations before a function is compiled; 0 if never.
+  unsigned mJitThreshold;
+  std::vector<unsigned> mHotness;
+  std::vector<NativeFunction> mNative;
+  std::unique_ptr<JitCompiler> mJit;
+  unsigned mNativeDepth;
+  // Where a frame whose call native code finished continues, to return the
+  // result in `imm`.
+  Instr mNativeExit;
+  uint64_t mNumCompiled;
+  uint64_t mNumLoopEntries;
+
+public:
+  BytecodeVM(Environment *env, BytecodeModule *module,
+             unsigned jitThreshold = 0)
+      : mEnv(env), mModule(module), mTop(0),
+        mArrays(env->getStackSize() / sizeof(int64_t), &env->getStackLimit()),
+        mJitThreshold(jitThreshold),
+        mHotness(module->functions.size(), 0),
+        mNative(module->functions.size(), NULL), mNativeDepth(0),
+        mNumCompiled(0), mNumLoopEntries(0) {
+    Instr exit = {OP_RetImm, 0, 0, 0, 0};
+    mNativeExit = exit;
+  }
+
+  // Run function `entry` with `args` to its end. Native code calls back in
+  // here for interpreted callees.
+  int64_t run(unsigned entry, const int64_t *args = NULL) {
+    const BytecodeFunction *func = &mModule->functions[entry];
+    size_t base = mTop;
+    size_t bottom = mFrames.size();
+    int64_t *arrays = mArrays.allocate(func->numArrayWords);
+    int64_t *R = enterFrame(func, base);
+    for (unsigned i = 0; args && i < func->numParams; i++)
+      R[i] = args[i];
+    const Instr *pc = func->code.data();
+    for (;;) {
+      const Instr &I = *pc++;
+      switch (I.op) {
+      case OP_Const:
+        R[I.a] = I.imm;
+        break;
+      case OP_Mov:
+        R[I.a] = R[I.b];
+        break;
+      case OP_Add:
+        R[I.a] = R[I.b] + R[I.c];
+        break;
+      case OP_Sub:
+        R[I.a] = R[I.b] - R[I.c];
+        break;
+      case OP_Mul:
+        R[I.a] = R[I.b] * R[I.c];
+        break;
+      case OP_Div:
+        R[I.a] = R[I.b] / R[I.c];
+        break;
+      case OP_EQ:
+        R[I.a] = R[I.b] == R[I.c];
+        break;
+      case OP_NE:
+        R[I.a] = R[I.b] != R[I.c];
+        break;
+      case OP_LT:
+        R[I.a] = R[I.b] < R[I.c];
+        break;
+      case OP_GT:
+        R[I.a] = R[I.b] > R[I.c];
+        break;
+      case OP_LE:
+        R[I.a] = R[I.b] <= R[I.c];
+        break;
+      case OP_GE:
+        R[I.a] = R[I.b] >= R[I.c];
+        break;
+      case OP_AddImm:
+        R[I.a] = R[I.b] + I.imm;
+        break;
+      case OP_PtrAdd:
+        R[I.a] = R[I.b] + R[I.c] * (int64_t)sizeof(int64_t);
+        break;
+      case OP_PtrSub:
+        R[I.a] = R[I.b] - R[I.c] * (int64_t)sizeof(int64_t);
+        break;
+      case OP_Neg:
+        R[I.a] = -R[I.b];
+        break;
+      case OP_Not:
+        R[I.a] = ~R[I.b];
+        break;
+      case OP_LNot:
+        R[I.a] = !R[I.b];
+        break;
+      case OP_SExtB:
+        R[I.a] = (int8_t)R[I.b];
+        break;
+      case OP_ZExtB:
+        R[I.a] = (uint8_t)R[I.b];
+        break;
+      case OP_Load:
+        R[I.a] = *(int64_t *)R[I.b];
+        break;
+      case OP_LoadB:
+        R[I.a] = *(int8_t *)R[I.b];
+        break;
+      case OP_LoadUB:
+        R[I.a] = *(uint8_t *)R[I.b];
+        break;
+      case OP_Store:
+        *(int64_t *)R[I.a] = R[I.b];
+        break;
+      case OP_StoreB:
+        *(int8_t *)R[I.a] = (int8_t)R[I.b];
+        break;
+      case OP_LoadIdx:
+        R[I.a] = ((int64_t *)R[I.b])[R[I.c]];
+        break;
+      case OP_LoadIdxB:
+        R[I.a] = ((int8_t *)R[I.b])[R[I.c]];
+        break;
+      case OP_LoadIdxUB:
+        R[I.a] = ((uint8_t *)R[I.b])[R[I.c]];
+        break;
+      case OP_StoreIdx:
+        ((int64_t *)R[I.a])[R[I.b]] = R[I.c];
+        break;
+      case OP_StoreIdxB:
+        ((int8_t *)R[I.a])[R[I.b]] = (int8_t)R[I.c];
+        break;
+      case OP_LoadGlobal:
+        R[I.a] = *(int64_t *)I.imm;
+        break;
+      case OP_StoreGlobal:
+        *(int64_t *)I.imm = R[I.b];
+        break;
+      case OP_Alloca: {
+        int64_t *array = arrays + I.imm;
+        memset(array, 0, I.b * sizeof(int64_t));
+        R[I.a] = (int64_t)array;
+        break;
+      }
+      case OP_Jmp:
+        pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_Jz:
+        if (!R[I.a])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_Jnz:
+        if (R[I.a])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JEQ:
+        if (R[I.a] == R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JNE:
+        if (R[I.a] != R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JLT:
+        if (R[I.a] < R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JGT:
+        if (R[I.a] > R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JLE:
+        if (R[I.a] <= R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_JGE:
+        if (R[I.a] >= R[I.b])
+          pc = jump(func, I, base, R, arrays);
+        break;
+      case OP_Call: {
+        const BytecodeFunction *callee = &mModule->functions[I.b];
+        if (callee->pure) {
+          MemoKey key;
+          key.function = callee->decl;
+          for (int64_t i = 0; i < MEMO_MAX_ARGS; i++)
+            key.args[i] = i < I.imm ? R[I.c + i] : 0;
+          if (mEnv->getMemo().lookup(key.function, key.args, R[I.a]))
+            break;
+          mMemoKeys.push_back(key);
+        }
+        if (NativeFunction native = getNative(I.b)) {
+          mTop = base + func->numRegs;
+          int64_t val = callNative(native, R + I.c, NULL, 0);
+          R = mRegs.data() + base;
+          R[I.a] = val;
+          if (callee->pure) {
+            const MemoKey &key = mMemoKeys.back();
+            mEnv->getMemo().store(key.function, key.args, val);
+            mMemoKeys.pop_back();
+          }
+          break;
+        }
+        Frame frame = {func, pc, base, I.a, arrays, callee->pure};
+        mFrames.push_back(frame);
+        size_t calleeBase = base + func->numRegs;
+        int64_t *regs = enterFrame(callee, calleeBase);
+        // The register file may have moved.
+        R = mRegs.data() + base;
+        for (int64_t i = 0; i < I.imm; i++)
+          regs[i] = R[I.c + i];
+        R = regs;
+        func = callee;
+        base = calleeBase;
+        arrays = mArrays.allocate(callee->numArrayWords);
+        pc = func->code.data();
+        break;
+      }
+      case OP_TailCall: {
+        // The callee takes over this frame: its parameters replace ours.
+        const BytecodeFunction *callee = &mModule->functions[I.b];
+        if (NativeFunction native = getNative(I.b)) {
+          mTop = base + func->numRegs;
+          mNativeExit.imm = callNative(native, R + I.c, NULL, 0);
+          pc = &mNativeExit;
+          break;
+        }
+        memmove(R, R + I.c, I.imm * sizeof(int64_t));
+        R = enterFrame(callee, base);
+        mArrays.release(arrays);
+        arrays = mArrays.allocate(callee->numArrayWords);
+        func = callee;
+        pc = func->code.data();
+        break;
+      }
+      case OP_Input:
+        R[I.a] = mEnv->input();
+        break;
+      case OP_Output:
+        mEnv->output(R[I.b]);
+        break;
+      case OP_Malloc:
+        R[I.a] = mEnv->allocate(R[I.b]);
+        break;
+      case OP_Free:
+        mEnv->release(R[I.b]);
+        break;
+      case OP_Ret:
+      case OP_RetImm: {
+        int64_t val = I.op == OP_Ret ? R[I.a] : I.imm;
+        mArrays.release(arrays);
+        if (mFrames.size() == bottom)
+          return val;
+        Frame &frame = mFrames.back();
+        func = frame.func;
+        pc = frame.pc;
+        base = frame.base;
+        arrays = frame.arrays;
+        R = mRegs.data() + base;
+        R[frame.dst] = val;
+        if (frame.memo) {
+          const MemoKey &key = mMemoKeys.back();
+          mEnv->getMemo().store(key.function, key.args, val);
+          mMemoKeys.pop_back();
+        }
+        mFrames.pop_back();
+        break;
+      }
+      }
+    }
+  }
+
+  void printStats(llvm::raw_ostream &os) const {
+    os << "jit: compiled " << mNumCompiled << " loop-entries "
+       << mNumLoopEntries << "\n";
+  }
+
+private:
+  // Jump to the target of `I`. A frame reaching the head of a loop in a
+  // function with native code finishes its call there; the frame then
+  // continues at mNativeExit.
+  const Instr *jump(const BytecodeFunction *func, const Instr &I, size_t base,
+                    int64_t *R, int64_t *arrays) {
+    if (I.c && mJitThreshold) {
+      if (NativeFunction native = getNative(func - mModule->functions.data())) {
+        mNumLoopEntries++;
+        mTop = base + func->numRegs;
+        mNativeExit.imm = callNative(native, R, arrays, I.imm);
+        return &mNativeExit;
+      }
+    }
+    return func->code.data() + I.imm;
+  }
+
+  // Count a call or loop iteration of function `index`, compiling it once
+  // it is hot, and return its native code if it has some that may be
+  // entered now.
+  NativeFunction getNative(unsigned index) {
+    if (!mJitThreshold)
+      return NULL;
+    if (!mNative[index] && ++mHotness[index] == mJitThreshold)
+      tierUp(index);
+    return mNativeDepth < MAX_NATIVE_DEPTH ? mNative[index] : NULL;
+  }
+
+  void tierUp(unsigned index) {
+    if (!mJit) {
+      JitRuntime runtime = {mEnv,        callFromNative, allocArrays,
+                            releaseArrays, input,        output,
+                            allocate,      release};
+      mJit.reset(new JitCompiler(runtime));
+    }
+    mNative[index] = mJit->compile(mModule->functions[index], index);
+    if (mNative[index])
+      mNumCompiled++;
+  }
+
+  int64_t callNative(NativeFunction native, int64_t *regs, int64_t *arrays,
+                     int64_t entry) {
+    mNativeDepth++;
+    int64_t val = native(this, regs, arrays, entry);
+    mNativeDepth--;
+    return val;
+  }
+
+  // The JitRuntime entry points.
+  static int64_t callFromNative(void *self, int64_t index, int64_t *args) {
+    BytecodeVM *vm = static_cast<BytecodeVM *>(self);
+    const BytecodeFunction *callee = &vm->mModule->functions[index];
+    MemoKey key;
+    int64_t val;
+    if (callee->pure) {
+      key.function = callee->decl;
+      for (unsigned i = 0; i < MEMO_MAX_ARGS; i++)
+        key.args[i] = i < callee->numParams ? args[i] : 0;
+      if (vm->mEnv->getMemo().lookup(key.function, key.args, val))
+        return val;
+    }
+    if (NativeFunction native = vm->getNative(index)) {
+      val = vm->callNative(native, args, NULL, 0);
+    } else {
+      size_t top = vm->mTop;
+      val = vm->run(index, args);
+      vm->mTop = top;
+    }
+    if (callee->pure)
+      vm->mEnv->getMemo().store(key.function, key.args, val);
+    return val;
+  }
+  static int64_t *allocArrays(void *self, int64_t size) {
+    return static_cast<BytecodeVM *>(self)->mArrays.allocate(size);
+  }
+  static void releaseArrays(void *self, int64_t *arrays) {
+    static_cast<BytecodeVM *>(self)->mArrays.release(arrays);
+  }
+  static int64_t input(void *env) {
+    return static_cast<Environment *>(env)->input();
+  }
+  static void output(void *env, int64_t val) {
+    static_cast<Environment *>(env)->output(val);
+  }
+  static int64_t allocate(void *env, int64_t size) {
+    return static_cast<Environment *>(env)->allocate(size);
+  }
+  static void release(void *env, int64_t ptr) {
+    static_cast<Environment *>(env)->release(ptr);
+  }
+
+  // Make room for `func`'s registers at `base` and load its constants.
+  int64_t *enterFrame(const BytecodeFunction *func, size_t base) {
+    // Registers and local arrays each may take the whole stack size.
+    if ((base + func->numRegs) * sizeof(int64_t) > mEnv->getStackSize())
+      stackOverflow(mEnv->getStackLimit());
+    if (mRegs.size() < base + func->numRegs)
+      mRegs.resize(std::max(mRegs.size() * 2, base + func->numRegs));
+    int64_t *regs = mRegs.data() + base;
+    for (size_t i = 0; i < func->consts.size(); i++)
+      regs[func->consts[i].first] = func->consts[i].second;
+    return regs;
+  }
+};
@@ -0,0 +1,172 @@
+//==--- ConstantFold.h - Constant folding pre-pass for the AST interpreter ===//
+//===----------------------------------------------------------------------===//
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+
+using namespace clang;
+
+// ConstantFolder computes, once per translation unit, the value of every
+// expression that does not depend on program state: literals, `sizeof`, and
+// arithmetic, comparisons and integer casts over those. The evaluators read
+// the values from this side table instead of computing them again each time
+// the expression is reached.
+class ConstantFolder {
+  llvm::DenseMap<const Expr *, int64_t> mValues;
+
+public:
+  void run(TranslationUnitDecl *unit) {
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+        if (fdecl->isThisDeclarationADefinition())
+          visit(fdecl->getBody());
+      } else if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
+        if (vardecl->hasInit())
+          visit(vardecl->getInit());
+      }
+    }
+  }
+
+  // The folded value of `expr`, or NULL if it has to be evaluated.
+  const int64_t *lookup(const Expr *expr) const {
+    llvm::DenseMap<const Expr *, int64_t>::const_iterator it =
+        mValues.find(expr);
+    if (it == mValues.end())
+      return NULL;
+    return &it->second;
+  }
+
+private:
+  // Fold every constant expression under `stmt`.
+  void visit(Stmt *stmt) {
+    if (!stmt)
+      return;
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+      fold(expr);
+      return;
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      visit(*it);
+  }
+
+  // Fold `expr` bottom-up and record it if it is constant. Subexpressions
+  // are visited either way, so constant operands of a non-constant
+  // expression are folded too.
+  bool fold(Expr *expr) {
+    bool constant = true;
+    for (Stmt::child_iterator it = expr->child_begin(), ie = expr->child_end();
+         it != ie; ++it) {
+      if (!*it)
+        continue;
+      if (Expr *sub = dyn_cast<Expr>(*it)) {
+        if (!fold(sub))
+          constant = false;
+      } else {
+        visit(*it);
+        constant = false;
+      }
+    }
+    int64_t val = 0;
+    if (IntegerLiteral *literal = dyn_cast<IntegerLiteral>(expr)) {
+      val = literal->getValue().getSExtValue();
+    } else if (UnaryExprOrTypeTraitExpr *ueot =
+                   dyn_cast<UnaryExprOrTypeTraitExpr>(expr)) {
+      if (ueot->getKind() != UETT_SizeOf) {
+        llvm::errs() << "Unsupported UEOT\n";
+        assert(false);
+      }
+      val = getTypeWidth(ueot->getTypeOfArgument());
+    } else if (!constant) {
+      return false;
+    } else if (ParenExpr *paren = dyn_cast<ParenExpr>(expr)) {
+      val = mValues[paren->getSubExpr()];
+    } else if (CastExpr *castexpr = dyn_cast<CastExpr>(expr)) {
+      // Integer casts convert the value as they do when evaluated.
+      if (!castexpr->getType()->isIntegerType())
+        return false;
+      val = mValues[castexpr->getSubExpr()];
+      if (castexpr->getCastKind() == CK_IntegralCast)
+        val = narrow(getMemKind(castexpr->getType()), val);
+    } else if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+      if (!foldBinary(bop, val))
+        return false;
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+      if (!foldUnary(uop, val))
+        return false;
+    } else {
+      return false;
+    }
+    mValues[expr] = val;
+    return true;
+  }
+
+  bool foldBinary(BinaryOperator *bop, int64_t &val) {
+    if (!bop->getLHS()->getType()->isIntegerType() ||
+        !bop->getRHS()->getType()->isIntegerType())
+      return false;
+    int64_t left = mValues[bop->getLHS()];
+    int64_t right = mValues[bop->getRHS()];
+    switch (bop->getOpcode()) {
+    case BO_Add:
+      val = left + right;
+      break;
+    case BO_Sub:
+      val = left - right;
+      break;
+    case BO_Mul:
+      val = left * right;
+      break;
+    case BO_Div:
+      // Leave the fault to run time, if it is ever reached.
+      if (right == 0)
+        return false;
+      val = left / right;
+      break;
+    case BO_EQ:
+      val = left == right;
+      break;
+    case BO_NE:
+      val = left != right;
+      break;
+    case BO_LT:
+      val = left < right;
+      break;
+    case BO_GT:
+      val = left > right;
+      break;
+    case BO_LE:
+      val = left <= right;
+      break;
+    case BO_GE:
+      val = left >= right;
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+
+  bool foldUnary(UnaryOperator *uop, int64_t &val) {
+    int64_t sub = mValues[uop->getSubExpr()];
+    switch (uop->getOpcode()) {
+    case UO_Plus:
+      val = sub;
+      break;
+    case UO_Minus:
+      val = -sub;
+      break;
+    case UO_Not:
+      val = ~sub;
+      break;
+    case UO_LNot:
+      val = !sub;
+      break;
+    default:
+      return false;
+    }
+    return true;
+  }
+};
@@ -0,0 +1,340 @@
+//==--- CountedLoop.h - Counted for-loops of the AST interpreter ----------===//
+//===----------------------------------------------------------------------===//
+#include <stdint.h>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "clang/AST/Stmt.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+
+using namespace clang;
+
+// What the body of a counted loop stepping by 1 or -1 does to the elements
+// `i` goes over, if it is nothing but one of these assignments.
+enum LoopIdiom {
+  LI_None,
+  // a[i] = value
+  LI_Fill,
+  // a[i] = b[i]
+  LI_Copy,
+  // s = s + b[i]
+  LI_Sum
+};
+
+// A for-loop stepping an integer variable towards a fixed bound.
+struct CountedLoop {
+  // The induction variable.
+  const VarSlot *var;
+  // How the variable is compared with the bound: BO_LT, BO_LE, BO_GT, BO_GE
+  // or BO_NE.
+  BinaryOperatorKind cmp;
+  Expr *bound;
+  // What the increment adds to the variable.
+  int64_t step;
+  LoopIdiom idiom;
+  // The array assigned, or the variable summed into for LI_Sum.
+  const VarSlot *target;
+  // The array read by LI_Copy and LI_Sum.
+  const VarSlot *source;
+  // The value LI_Fill stores; it reads no memory.
+  Expr *value;
+  // How the elements are stored; LI_Copy reads them as they are written.
+  MemKind elem;
+
+  // How many times the body runs when `var` starts at `start`, if that is
+  // easy to tell: the step is 1 or -1 and goes towards the bound.
+  bool getTripCount(int64_t start, int64_t bound, uint64_t &count) const {
+    if (step == 1) {
+      switch (cmp) {
+      case BO_LT:
+        count = start < bound ? (uint64_t)bound - (uint64_t)start : 0;
+        return true;
+      case BO_LE:
+        count = start <= bound ? (uint64_t)bound - (uint64_t)start + 1 : 0;
+        return bound != INT64_MAX;
+      case BO_NE:
+        count = (uint64_t)bound - (uint64_t)start;
+        return start <= bound;
+      default:
+        return false;
+      }
+    }
+    if (step == -1) {
+      switch (cmp) {
+      case BO_GT:
+        count = start > bound ? (uint64_t)start - (uint64_t)bound : 0;
+        return true;
+      case BO_GE:
+        count = start >= bound ? (uint64_t)start - (uint64_t)bound + 1 : 0;
+        return bound != INT64_MIN;
+      case BO_NE:
+        count = (uint64_t)start - (uint64_t)bound;
+        return start >= bound;
+      default:
+        return false;
+      }
+    }
+    return false;
+  }
+};
+
+// LoopAnalysis finds the for-loops of the shape
+//   for (init; i < bound; i = i + step)
+// where `step` is a constant, the comparison is any of <, <=, >, >= and !=,
+// and the increment may also be `i = i - step`, `i = step + i`, `++i`,
+// `i++`, `--i` or `i--`. `bound` must be built from constants and variables
+// other than `i` with arithmetic alone, and the body must assign neither
+// `i` nor those variables. Since a called function may assign globals, a
+// loop involving one also must not call interpreted functions. Such a loop
+// can evaluate its bound once and count `i` without walking the condition
+// and the increment on each iteration.
+//
+// A loop whose body is a LoopIdiom can even run as one bulk operation over
+// the elements `i` goes through. `a` and `b` must be variables other than
+// `i`, and the fill value must be invariant. Variables cannot have their
+// address taken, so only the arrays of a copy may overlap; that is checked
+// when the loop runs.
+class LoopAnalysis {
+  llvm::DenseMap<const ForStmt *, CountedLoop> mLoops;
+
+public:
+  void run(TranslationUnitDecl *unit, const ConstantFolder &folder,
+           const Layout &layout) {
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i))
+        if (fdecl->isThisDeclarationADefinition())
+          visit(fdecl->getBody(), folder, layout);
+    }
+  }
+
+  // The counted loop `loop` is, or NULL if it has to be run in general.
+  const CountedLoop *lookup(const ForStmt *loop) const {
+    llvm::DenseMap<const ForStmt *, CountedLoop>::const_iterator it =
+        mLoops.find(loop);
+    if (it == mLoops.end())
+      return NULL;
+    return &it->second;
+  }
+
+private:
+  // What the body of a loop may change.
+  struct Effects {
+    llvm::DenseSet<const VarDecl *> assigned;
+    // Whether it calls an interpreted function.
+    bool calls;
+  };
+
+  void visit(Stmt *stmt, const ConstantFolder &folder, const Layout &layout) {
+    if (!stmt)
+      return;
+    if (ForStmt *forstmt = dyn_cast<ForStmt>(stmt)) {
+      CountedLoop loop;
+      if (match(forstmt, folder, layout, loop))
+        mLoops[forstmt] = loop;
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      visit(*it, folder, layout);
+  }
+
+  static bool match(ForStmt *forstmt, const ConstantFolder &folder,
+                    const Layout &layout, CountedLoop &loop) {
+    BinaryOperator *cond = dyn_cast_or_null<BinaryOperator>(
+        forstmt->getCond() ? forstmt->getCond()->IgnoreParens() : NULL);
+    if (!cond || !forstmt->getInc())
+      return false;
+    switch (cond->getOpcode()) {
+    case BO_LT:
+    case BO_LE:
+    case BO_GT:
+    case BO_GE:
+    case BO_NE:
+      break;
+    default:
+      return false;
+    }
+    const VarDecl *var = getVar(cond->getLHS());
+    // Characters wrap around, so they are not counted.
+    if (!var || !var->getType()->isIntegerType() ||
+        getMemKind(var->getType()) != MK_Word ||
+        !matchStep(forstmt->getInc(), var, folder, loop.step))
+      return false;
+    Effects effects;
+    effects.calls = false;
+    collectEffects(forstmt->getBody(), effects);
+    if (!isInvariant(var, effects) ||
+        !isInvariantExpr(cond->getRHS(), var, folder, effects))
+      return false;
+    loop.var = layout.findVar(var);
+    loop.cmp = cond->getOpcode();
+    loop.bound = cond->getRHS();
+    matchIdiom(forstmt->getBody(), var, folder, layout, effects, loop);
+    return loop.var != NULL;
+  }
+
+  static void matchIdiom(Stmt *body, const VarDecl *induction,
+                         const ConstantFolder &folder, const Layout &layout,
+                         const Effects &effects, CountedLoop &loop) {
+    loop.idiom = LI_None;
+    loop.target = loop.source = NULL;
+    loop.value = NULL;
+    loop.elem = MK_Word;
+    if (loop.step != 1 && loop.step != -1)
+      return;
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(body)) {
+      if (compound->size() != 1)
+        return;
+      body = *compound->body_begin();
+    }
+    BinaryOperator *assign = dyn_cast<BinaryOperator>(body);
+    if (!assign || assign->getOpcode() != BO_Assign)
+      return;
+    Expr *rhs = assign->getRHS();
+    const VarDecl *target = NULL;
+    const VarDecl *source = NULL;
+    if (ArraySubscriptExpr *dst = getElement(assign->getLHS(), induction)) {
+      target = getVar(dst->getBase());
+      loop.elem = getMemKind(dst->getType());
+      ArraySubscriptExpr *src = getElement(rhs, induction);
+      if (src && getMemKind(src->getType()) == loop.elem) {
+        source = getVar(src->getBase());
+        loop.idiom = LI_Copy;
+      } else if (isInvariantExpr(rhs, induction, folder, effects)) {
+        loop.value = rhs;
+        loop.idiom = LI_Fill;
+      }
+    } else if ((target = getVar(assign->getLHS()))) {
+      BinaryOperator *add =
+          dyn_cast<BinaryOperator>(rhs->IgnoreParenImpCasts());
+      if (target == induction || !target->getType()->isIntegerType() ||
+          getMemKind(target->getType()) != MK_Word || !add ||
+          add->getOpcode() != BO_Add)
+        return;
+      Expr *other = getVar(add->getLHS()) == target ? add->getRHS()
+                    : getVar(add->getRHS()) == target ? add->getLHS()
+                                                      : NULL;
+      ArraySubscriptExpr *src = other ? getElement(other, induction) : NULL;
+      if (src && src->getType()->isIntegerType()) {
+        source = getVar(src->getBase());
+        loop.elem = getMemKind(src->getType());
+        loop.idiom = LI_Sum;
+      }
+    }
+    // The body assigns the variable summed into, but none of the arrays.
+    if (loop.idiom == LI_None ||
+        (loop.idiom != LI_Sum && !isInvariant(target, effects)) ||
+        (source && !isInvariant(source, effects))) {
+      loop.idiom = LI_None;
+      return;
+    }
+    loop.target = layout.findVar(target);
+    loop.source = source ? layout.findVar(source) : NULL;
+    if (!loop.target || (source && !loop.source))
+      loop.idiom = LI_None;
+  }
+
+  // `expr` if it reads or names `a[i]`, with `a` a variable and `i` the
+  // induction variable.
+  static ArraySubscriptExpr *getElement(Expr *expr,
+                                        const VarDecl *induction) {
+    ArraySubscriptExpr *element =
+        dyn_cast<ArraySubscriptExpr>(expr->IgnoreParenImpCasts());
+    if (!element || getVar(element->getIdx()) != induction)
+      return NULL;
+    const VarDecl *base = getVar(element->getBase());
+    if (!base || base == induction)
+      return NULL;
+    return element;
+  }
+
+  // The variable `expr` reads or names, if that is all it does.
+  static const VarDecl *getVar(Expr *expr) {
+    DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr->IgnoreParenImpCasts());
+    if (!declref)
+      return NULL;
+    return dyn_cast<VarDecl>(declref->getFoundDecl());
+  }
+
+  // Whether `inc` adds a constant to `var`, and which.
+  static bool matchStep(Expr *inc, const VarDecl *var,
+                        const ConstantFolder &folder, int64_t &step) {
+    inc = inc->IgnoreParens();
+    if (UnaryOperator *uop = dyn_cast<UnaryOperator>(inc)) {
+      if (!uop->isIncrementDecrementOp() || getVar(uop->getSubExpr()) != var)
+        return false;
+      step = uop->isIncrementOp() ? 1 : -1;
+      return true;
+    }
+    BinaryOperator *assign = dyn_cast<BinaryOperator>(inc);
+    if (!assign || assign->getOpcode() != BO_Assign ||
+        getVar(assign->getLHS()) != var)
+      return false;
+    BinaryOperator *arith =
+        dyn_cast<BinaryOperator>(assign->getRHS()->IgnoreParenImpCasts());
+    if (!arith ||
+        (arith->getOpcode() != BO_Add && arith->getOpcode() != BO_Sub))
+      return false;
+    const int64_t *left = folder.lookup(arith->getLHS());
+    const int64_t *right = folder.lookup(arith->getRHS());
+    if (getVar(arith->getLHS()) == var && right) {
+      step = arith->getOpcode() == BO_Add ? *right : -*right;
+      return true;
+    }
+    if (arith->getOpcode() == BO_Add && getVar(arith->getRHS()) == var &&
+        left) {
+      step = *left;
+      return true;
+    }
+    return false;
+  }
+
+  static void collectEffects(Stmt *stmt, Effects &effects) {
+    if (!stmt)
+      return;
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(stmt)) {
+      if (bop->isAssignmentOp())
+        if (const VarDecl *var = getVar(bop->getLHS()))
+          effects.assigned.insert(var);
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+      if (uop->isIncrementDecrementOp())
+        if (const VarDecl *var = getVar(uop->getSubExpr()))
+          effects.assigned.insert(var);
+    } else if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+      // Built-ins have no definition.
+      FunctionDecl *callee = call->getDirectCallee();
+      if (!callee || callee->getDefinition())
+        effects.calls = true;
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      collectEffects(*it, effects);
+  }
+
+  static bool isInvariant(const VarDecl *var, const Effects &effects) {
+    return !effects.assigned.count(var) &&
+           !(var->hasGlobalStorage() && effects.calls);
+  }
+
+  static bool isInvariantExpr(Expr *expr, const VarDecl *induction,
+                              const ConstantFolder &folder,
+                              const Effects &effects) {
+    if (folder.lookup(expr))
+      return true;
+    expr = expr->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+      const VarDecl *var = dyn_cast<VarDecl>(declref->getFoundDecl());
+      return var && var != induction && var->getType()->isIntegerType() &&
+             isInvariant(var, effects);
+    }
+    if (CastExpr *cast = dyn_cast<CastExpr>(expr))
+      return isInvariantExpr(cast->getSubExpr(), induction, folder, effects);
+    if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr))
+      return !bop->isAssignmentOp() &&
+             isInvariantExpr(bop->getLHS(), induction, folder, effects) &&
+             isInvariantExpr(bop->getRHS(), induction, folder, effects);
+    return false;
+  }
+};
@@ -1,7 +1,12 @@
 //==--- tools/clang-check/ClangInterpreter.cpp - Clang Interpreter tool
 //--------------===//
 //===----------------------------------------------------------------------===//
+#include <new>
+#include <setjmp.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/mman.h>
 
 #include "clang/AST/ASTConsumer.h"
 #include "clang/AST/Decl.h"
@@ -12,84 +17,347 @@
 
 using namespace clang;
 
+#include "Heap.h"
+#include "IO.h"
+#include "Layout.h"
+#include "CountedLoop.h"
+#include "Memo.h"
+
 // Each StackFrame represents a function. StackFrame maps variable declaration,
 // expressions and pointers to Value, which is represented in the form of either
-// integer or addresses.
+// integer or addresses. Variables and expressions are stored in flat arrays
+// indexed by the slots the Layout assigned to them. The arrays follow the
+// StackFrame itself in the FrameArena, and so does the storage of the local
+// arrays of the function, which is released with the frame.
 class StackFrame {
-  std::map<Decl *, int64_t> mVars;
-  std::map<Stmt *, int64_t> mExprs;
-  std::map<Stmt *, int64_t *> mPtrs;
+  int64_t *mVars;
+  int64_t *mExprs;
+  int64_t **mPtrs;
+  int64_t *mArrays;
+  const Layout *mLayout;
   // The return value of the function.
   int64_t returnValue;
 
 public:
-  StackFrame() : mVars(), mExprs(), mPtrs() {}
+  StackFrame(const Layout *layout, const FunctionLayout &function,
+             int64_t *slots)
+      : mVars(slots), mExprs(slots + function.numVars),
+        mPtrs(reinterpret_cast<int64_t **>(mExprs + function.numExprs)),
+        mArrays(mExprs + 2 * function.numExprs), mLayout(layout),
+        returnValue(0) {
+    memset(mVars, 0, function.numVars * sizeof(int64_t));
+  }
 
-  // The following functions update or inquire the maps in StackFrame.
-  void bindDecl(Decl *decl, int64_t val) {
+  // The following functions update or inquire the slots in StackFrame.
+  void bindDecl(unsigned slot, int64_t val) {
     // printf("debug bindDecl val = %ld\n", val);
-    mVars[decl] = val;
+    mVars[slot] = val;
   }
-  int64_t getDeclVal(Decl *decl) {
-    assert(mVars.find(decl) != mVars.end());
-    // printf("debug getDeclVal val = %ld\n", mVars.find(decl)->second);
-    return mVars.find(decl)->second;
-  }
-  bool hasDecl(Decl *decl) { return (mVars.find(decl) != mVars.end()); }
+  int64_t *getDeclAddr(unsigned slot) { return &mVars[slot]; }
+  // The elements of a local array, at the offset the Layout gave it.
+  int64_t *getArrayStorage(unsigned offset) { return mArrays + offset; }
   void bindStmt(Stmt *stmt, int64_t val) {
     // printf("debug bindStmt val = %ld\n", val);
-    mExprs[stmt] = val;
+    mExprs[mLayout->getExprSlot(stmt)] = val;
   }
   int64_t getStmtVal(Stmt *stmt) {
-    if (mExprs.find(stmt) == mExprs.end()) {
-      llvm::errs() << "Statement not found\n";
-      stmt->dump();
-      assert(false);
-    }
-    // printf("debug getStmtVal val = %ld\n", mExprs[stmt]);
-    return mExprs[stmt];
+    return getSlotVal(mLayout->getExprSlot(stmt));
   }
   void bindPtr(Stmt *stmt, int64_t *val) {
     // printf("debug bindPtr val = %ld\n", *val);
-    mPtrs[stmt] = val;
+    mPtrs[mLayout->getExprSlot(stmt)] = val;
   }
-  int64_t *getPtr(Stmt *stmt) {
-    assert(mPtrs.find(stmt) != mPtrs.end());
-    return mPtrs[stmt];
+  int64_t *getPtr(Stmt *stmt) { return mPtrs[mLayout->getExprSlot(stmt)]; }
+  // The same, by expression slots resolved ahead of time.
+  void bindSlot(unsigned slot, int64_t val) { mExprs[slot] = val; }
+  int64_t getSlotVal(unsigned slot) {
+    if (slot & Layout::CONST_SLOT)
+      return mLayout->getConstant(slot);
+    return mExprs[slot];
   }
+  void bindSlotPtr(unsigned slot, int64_t *val) { mPtrs[slot] = val; }
+  int64_t *getSlotPtr(unsigned slot) { return mPtrs[slot]; }
   void setReturnValue(int64_t value) { returnValue = value; }
   int64_t getReturnValue() { return returnValue; }
 };
 
+// Where a program stops once its calls outgrow the interpreted stack. The
+// run of main arms `target`, and the engines jump back to it from wherever
+// the stack ran out, so only that program fails. Nothing they skip owns any
+// memory; their state lives in objects that outlive the run.
+struct StackLimit {
+  jmp_buf target;
+  bool armed;
+};
+
+static void stackOverflow(StackLimit &limit) {
+  if (limit.armed)
+    longjmp(limit.target, 1);
+  llvm::errs() << "Interpreted stack overflow\n";
+  exit(1);
+}
+
+// FrameArena is one contiguous region used as a stack of StackFrames. Entering
+// a function bumps the top by the size of the callee's frame and leaving it
+// moves the top back, so calls never copy or reallocate live frames. Pages of
+// the region are only committed once a frame first reaches them. The bytecode
+// VM uses one for the local arrays of its frames.
+class FrameArena {
+  int64_t *mRegion;
+  size_t mSize;
+  size_t mTop;
+  StackLimit *mLimit;
+
+  static const size_t HEADER_SIZE =
+      (sizeof(StackFrame) + sizeof(int64_t) - 1) / sizeof(int64_t);
+
+  FrameArena(const FrameArena &) = delete;
+  FrameArena &operator=(const FrameArena &) = delete;
+
+public:
+  // `size` words, only reserved up front, so a large region costs address
+  // space rather than memory. Outgrowing them is a `limit` overflow.
+  FrameArena(size_t size, StackLimit *limit)
+      : mSize(size), mTop(0), mLimit(limit) {
+    void *region = mmap(NULL, size * sizeof(int64_t), PROT_READ | PROT_WRITE,
+                        MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (region == MAP_FAILED) {
+      llvm::errs() << "Cannot reserve the interpreted stack\n";
+      exit(1);
+    }
+    mRegion = static_cast<int64_t *>(region);
+  }
+  ~FrameArena() { munmap(mRegion, mSize * sizeof(int64_t)); }
+
+  int64_t *allocate(size_t size) {
+    if (mTop + size > mSize)
+      stackOverflow(*mLimit);
+    int64_t *block = mRegion + mTop;
+    mTop += size;
+    return block;
+  }
+  // Release `block` and everything allocated after it.
+  void release(int64_t *block) { mTop = block - mRegion; }
+
+  StackFrame *push(const Layout *layout, const FunctionLayout &function) {
+    int64_t *frame = allocate(HEADER_SIZE + function.frameSize);
+    return new (frame) StackFrame(layout, function, frame + HEADER_SIZE);
+  }
+  // Release `frame` and every frame pushed after it.
+  void pop(StackFrame *frame) { release(reinterpret_cast<int64_t *>(frame)); }
+};
+
+// The built-in functions declared by every test program.
+enum BuiltinKind { BK_None, BK_Input, BK_Output, BK_Malloc, BK_Free };
+
+class Environment;
+struct OperatorSite;
+
+// Operators are evaluated by handlers specialized on their opcode and on the
+// kinds of their operands, so evaluating one queries no types.
+typedef void (*OperatorHandler)(Environment *, const OperatorSite &);
+
+// An operator bound to its handler, with the slots it reads and writes.
+struct OperatorSite {
+  OperatorHandler handler;
+  // Expression slots of the operator and its operands; `right` is unused by
+  // unary operators.
+  unsigned result, left, right;
+  // The variable assigned or incremented, if the target is one.
+  const VarSlot *var;
+};
+
+// A variable reference resolved ahead of time: the variable it reads and
+// the expression slot its value goes to.
+struct VarRef {
+  const VarSlot *var;
+  unsigned result;
+};
+
+// A call resolved ahead of time, so evaluating one looks nothing up but its
+// CallSite.
+struct CallSite {
+  BuiltinKind builtin;
+  // The definition of an interpreted callee, its body and its frame; NULL
+  // for built-ins.
+  FunctionDecl *callee;
+  Stmt *body;
+  const FunctionLayout *frame;
+  // Expression slot of the call. Its arguments' slots are the `numArgs`
+  // entries of Environment::mArgSlots from `firstArg`; argument `i` binds
+  // variable slot `i` of the callee.
+  unsigned result, firstArg, numArgs;
+  // Whether the callee can take over the caller's frame, and whether the
+  // call is answered from the MemoTable.
+  bool tail;
+  bool pure;
+};
+
 // Environment is where the procedure execute.
 class Environment {
-  std::vector<StackFrame> mStack;
+  // Bytes the frames of interpreted calls may take, and where a program
+  // exceeding them stops.
+  size_t mStackSize;
+  StackLimit mStackLimit;
+  FrameArena mFrames;
+  std::vector<StackFrame *> mStack;
   // Declartions to the built-in functions.
   FunctionDecl *mFree;
   FunctionDecl *mMalloc;
   FunctionDecl *mInput;
   FunctionDecl *mOutput;
   FunctionDecl *mEntry;
-  // Maps for global variables.
-  std::map<Decl *, int64_t> gVars;
+  // Blocks handed out by MALLOC.
+  Heap mHeap;
+  // Where PRINT writes and GET reads.
+  IOChannel mIO;
+  // The global segment, indexed by the global slots of the Layout.
+  std::vector<int64_t> gVars;
+  // Values of the constant expressions of the translation unit.
+  ConstantFolder mConstants;
+  // Expression and variable slots of every function.
+  Layout mLayout;
+  // The handler of every operator that is evaluated, and the variable of
+  // every variable reference.
+  llvm::DenseMap<const Expr *, OperatorSite> mOperators;
+  llvm::DenseMap<const DeclRefExpr *, VarRef> mVarRefs;
+  // Functions whose calls are memoized, and their results.
+  bool mMemoize;
+  PurityAnalysis mPurity;
+  MemoTable mMemo;
+  // Every call that is evaluated, and the arguments of a tail call in
+  // flight.
+  llvm::DenseMap<const CallExpr *, CallSite> mCalls;
+  std::vector<unsigned> mArgSlots;
+  std::vector<int64_t> mArgs;
+  // For-loops the AST walker runs by counting.
+  LoopAnalysis mLoops;
 
 public:
+  static const size_t DEFAULT_STACK_SIZE = (size_t)1 << 30;
+
   // Get the declartions to the built-in functions.
-  Environment()
-      : mStack(), mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL),
-        mEntry(NULL) {
+  explicit Environment(size_t stackSize = DEFAULT_STACK_SIZE)
+      : mStackSize(stackSize),
+        mFrames(stackSize / sizeof(int64_t), &mStackLimit), mStack(),
+        mFree(NULL), mMalloc(NULL), mInput(NULL), mOutput(NULL), mEntry(NULL),
+        mMemoize(true) {
+    mStackLimit.armed = false;
+  }
+
+  size_t getStackSize() { return mStackSize; }
+  StackLimit &getStackLimit() { return mStackLimit; }
+
+  // Whether calls to pure functions are answered from the MemoTable. This
+  // must be set before `prepare`.
+  void setMemoize(bool memoize) { mMemoize = memoize; }
+
+  // Fold constants and lay out the frames of the translation unit. This must
+  // run before any expression is evaluated.
+  void prepare(TranslationUnitDecl *unit) {
+    mConstants.run(unit);
+    mLayout.build(unit, mConstants);
+    mLoops.run(unit, mConstants, mLayout);
+    if (mMemoize)
+      mPurity.run(unit);
+    findBuiltins(unit);
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+        if (fdecl->isThisDeclarationADefinition()) {
+          resolveOperators(fdecl->getBody());
+          findTailCalls(fdecl->getBody(), true, fdecl);
+        }
+      } else if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
+        if (vardecl->hasInit())
+          resolveOperators(vardecl->getInit());
+      }
+    }
+    gVars.assign(mLayout.getNumGlobalVars(), 0);
     // Initialize a temporary StackFrame to process global variables.
-    mStack.push_back(StackFrame());
+    mStack.push_back(mFrames.push(&mLayout, mLayout.getGlobals()));
   }
 
-  // `getExprValue` and `getEntry` are called by ASTInterpreter.cpp.
-  int64_t getExprValue(Expr *expr) { return mStack.back().getStmtVal(expr); }
+  // `getExprValue`, `getEntry` and `getEntryResult` are called by
+  // ASTInterpreter.cpp.
+  int64_t getExprValue(Expr *expr) { return mStack.back()->getStmtVal(expr); }
   FunctionDecl *getEntry() { return mEntry; }
+  // What the entry function returned, once the AST walker finished it.
+  int64_t getEntryResult() { return mStack.back()->getReturnValue(); }
+  // The folded value of `expr`, or NULL if it has to be evaluated.
+  const int64_t *getConstant(Expr *expr) { return mConstants.lookup(expr); }
+  // What makes `loop` a counted loop, or NULL if it is not one.
+  const CountedLoop *getCountedLoop(ForStmt *loop) {
+    return mLoops.lookup(loop);
+  }
+
+  // Run the idiom of `loop` on the `count` elements from index `first` on,
+  // LI_Fill storing `value`. False if it has to run element by element
+  // instead, because the arrays of a copy overlap.
+  bool runLoopIdiom(const CountedLoop &loop, int64_t first, uint64_t count,
+                    int64_t value) {
+    switch (loop.elem) {
+    case MK_Byte:
+      return runLoopIdiom<MK_Byte>(loop, first, count, value);
+    case MK_UByte:
+      return runLoopIdiom<MK_UByte>(loop, first, count, value);
+    default:
+      return runLoopIdiom<MK_Word>(loop, first, count, value);
+    }
+  }
+
+  // Tell which built-in function `callee` is, if any.
+  BuiltinKind getBuiltinKind(FunctionDecl *callee) {
+    if (callee == mInput)
+      return BK_Input;
+    if (callee == mOutput)
+      return BK_Output;
+    if (callee == mMalloc)
+      return BK_Malloc;
+    if (callee == mFree)
+      return BK_Free;
+    return BK_None;
+  }
+
+  // The storage of a global variable, or NULL if `decl` is not a global. The
+  // address stays valid after `prepare`, so it can be baked into bytecode.
+  int64_t *getGlobalAddr(Decl *decl) {
+    const VarSlot *slot = mLayout.findVar(decl);
+    if (!slot || !slot->global)
+      return NULL;
+    return &gVars[slot->index];
+  }
+
+  // The storage of the variable `decl` refers to, local or global.
+  int64_t *getVarAddr(Decl *decl) {
+    const VarSlot *slot = mLayout.findVar(decl);
+    if (!slot)
+      return NULL;
+    return getVarAddr(slot);
+  }
+  int64_t *getVarAddr(const VarSlot *slot) {
+    if (slot->global)
+      return &gVars[slot->index];
+    return mStack.back()->getDeclAddr(slot->index);
+  }
+
+  // The built-in functions themselves, shared by the tree walker and the VM.
+  int64_t input() { return mIO.readInt(); }
+  void output(int64_t val) { mIO.print(val); }
+  int64_t allocate(int64_t size) {
+    return reinterpret_cast<int64_t>(mHeap.allocate(size));
+  }
+  void release(int64_t ptr) { mHeap.release(reinterpret_cast<void *>(ptr)); }
+  const Heap &getHeap() { return mHeap; }
+  IOChannel &getIO() { return mIO; }
+  MemoTable &getMemo() { return mMemo; }
+  bool isPure(FunctionDecl *callee) { return mPurity.isPure(callee); }
 
   // Save the result of a function with return value.
   void returnStmt(Expr *retexpr) {
-    int64_t returnValue = mStack.back().getStmtVal(retexpr);
-    mStack.back().setReturnValue(returnValue);
+    int64_t returnValue = mStack.back()->getStmtVal(retexpr);
+    mStack.back()->setReturnValue(returnValue);
   }
 
   // Initialize the Environment.
@@ -97,177 +365,33 @@ public:
     for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
                                             e = unit->decls_end();
          i != e; ++i) {
-      // Process functions.
-      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
-        if (fdecl->getName().equals("FREE"))
-          mFree = fdecl;
-        else if (fdecl->getName().equals("MALLOC"))
-          mMalloc = fdecl;
-        else if (fdecl->getName().equals("GET"))
-          mInput = fdecl;
-        else if (fdecl->getName().equals("PRINT"))
-          mOutput = fdecl;
-        else if (fdecl->getName().equals("main"))
-          mEntry = fdecl;
-      }
-      // Process global variables. They are directly stored in a map settled in
-      // the Environment.
-      else if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
+      // Process global variables. They are directly stored in the global
+      // segment settled in the Environment.
+      if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
         if (vardecl->hasInit()) {
-          int64_t val = mStack.back().getStmtVal(vardecl->getInit());
-          gVars[vardecl] = val;
-        } else {
-          gVars[vardecl] = 0;
+          int64_t val = mStack.back()->getStmtVal(vardecl->getInit());
+          *getGlobalAddr(vardecl) = val;
         }
       }
     }
     // Delete the temporary StackFrame and start a new StackFrame.
+    mFrames.pop(mStack.back());
     mStack.pop_back();
-    mStack.push_back(StackFrame());
-  }
-
-  // Adding all literals into mStack to help procedures access them by
-  // getStmtVal, for literals(the form of constant numbers) are seen as a kind
-  // of expressions.
-  void literal(Expr *expr) {
-    if (IntegerLiteral *literal = dyn_cast<IntegerLiteral>(expr)) {
-      mStack.back().bindStmt(expr, literal->getValue().getSExtValue());
-    } else {
-      llvm::errs() << "Unsupported literal\n";
-      assert(false);
-    }
-  }
-
-  // Deal with `sizeof` in a statement.
-  void ueot(UnaryExprOrTypeTraitExpr *ueotexpr) {
-    UnaryExprOrTypeTrait kind = ueotexpr->getKind();
-    int64_t result = 0;
-    if (kind == UETT_SizeOf) {
-      result = sizeof(int64_t);
-    } else {
-      llvm::errs() << "Unsupported UEOT\n";
-      assert(false);
-    }
-    mStack.back().bindStmt(ueotexpr, result);
+    if (mEntry)
+      mStack.push_back(mFrames.push(&mLayout, mLayout.getFunction(mEntry)));
   }
 
   // Deal with `*(a+1)` in a statement.
   void paren(ParenExpr *parenexpr) {
-    mStack.back().bindStmt(parenexpr,
-                           mStack.back().getStmtVal(parenexpr->getSubExpr()));
-  }
-
-  void array(ArraySubscriptExpr *arraysubscript) {
-    Expr *base = arraysubscript->getBase();
-    Expr *index = arraysubscript->getIdx();
-    int64_t *basePtr = (int64_t *)mStack.back().getStmtVal(base);
-    int64_t indexVal = mStack.back().getStmtVal(index);
-    mStack.back().bindPtr(arraysubscript, basePtr + indexVal);
-    mStack.back().bindStmt(arraysubscript, *(basePtr + indexVal));
-  }
-
-  void binop(BinaryOperator *bop) {
-    // printf("debug binop\n");
-    Expr *left = bop->getLHS();
-    Expr *right = bop->getRHS();
-    int64_t result = 0;
-    int64_t rightValue = mStack.back().getStmtVal(right);
-
-    if (bop->isAssignmentOp()) {
-      if (DeclRefExpr *declexpr = dyn_cast<DeclRefExpr>(left)) {
-        Decl *decl = declexpr->getFoundDecl();
-        mStack.back().bindDecl(decl, rightValue);
-      }
-      // Deal with `*a = 1` situation.
-      else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(left)) {
-        int64_t *ptr = mStack.back().getPtr(left);
-        *ptr = rightValue;
-      }
-      // Deal with `a[0] = 1` situation.
-      else if (isa<ArraySubscriptExpr>(left)) {
-        // ptr is assigned by calculating the address for the index of an array.
-        int64_t *ptr = mStack.back().getPtr(left);
-        *ptr = rightValue;
-      } else {
-        llvm::errs() << "Unsupported left value type in binop\n";
-        assert(false);
-      }
-      result = rightValue;
-    } else {
-      int64_t leftValue = mStack.back().getStmtVal(left);
-      typedef BinaryOperatorKind Opcode;
-      Opcode opc = bop->getOpcode();
-
-      // In `*a+1` situation, the unit movement distance is sizeof(int64_t).
-      if (left->getType()->isPointerType() &&
-          right->getType()->isIntegerType()) {
-        assert(opc == BO_Add || opc == BO_Sub);
-        rightValue = rightValue * sizeof(int64_t);
-      } else if (left->getType()->isIntegerType() &&
-                 right->getType()->isPointerType()) {
-        assert(opc == BO_Add || opc == BO_Sub);
-        leftValue = leftValue * sizeof(int64_t);
-      }
-      if (opc == BO_Add)
-        result = leftValue + rightValue;
-      else if (opc == BO_Sub)
-        result = leftValue - rightValue;
-      else if (opc == BO_Mul)
-        result = leftValue * rightValue;
-      else if (opc == BO_Div)
-        result = leftValue / rightValue;
-      else if (opc == BO_EQ)
-        result = leftValue == rightValue;
-      else if (opc == BO_NE)
-        result = leftValue != rightValue;
-      else if (opc == BO_LT)
-        result = leftValue < rightValue;
-      else if (opc == BO_GT)
-        result = leftValue > rightValue;
-      else if (opc == BO_LE)
-        result = leftValue <= rightValue;
-      else if (opc == BO_GE)
-        result = leftValue >= rightValue;
-      else {
-        llvm::errs() << "Unsupported operation in binop\n";
-        assert(false);
-      }
-    }
-    mStack.back().bindStmt(bop, result);
+    mStack.back()->bindStmt(parenexpr,
+                           mStack.back()->getStmtVal(parenexpr->getSubExpr()));
   }
 
-  void unaryop(UnaryOperator *uop) {
-    // printf("debug unaryop\n");
-    int64_t value = mStack.back().getStmtVal(uop->getSubExpr());
-    int64_t result = 0;
-    typedef UnaryOperatorKind Opcode;
-    Opcode opc = uop->getOpcode();
-    if (opc == UO_Plus)
-      result = value;
-    else if (opc == UO_Minus)
-      result = -value;
-    else if (opc == UO_Not)
-      result = ~value;
-    else if (opc == UO_LNot)
-      result = !value;
-    else if (opc == UO_PostInc)
-      result = value++;
-    else if (opc == UO_PostDec)
-      result = value--;
-    else if (opc == UO_PreInc)
-      result = ++value;
-    else if (opc == UO_PreDec)
-      result = --value;
-    else if (opc == UO_Deref) {
-      // printf("debug start to bindPtr in unaryop\n");
-      mStack.back().bindPtr(uop, (int64_t *)value);
-      result = *(int64_t *)value;
-    } else {
-      llvm::errs() << "Unsupported operation in unaryop\n";
-      assert(false);
-    }
-    mStack.back().bindStmt(uop, result);
-  }
+  void array(ArraySubscriptExpr *arraysubscript) { evaluate(arraysubscript); }
+
+  // Evaluate an operator through the handler `prepare` bound it to.
+  void binop(BinaryOperator *bop) { evaluate(bop); }
+  void unaryop(UnaryOperator *uop) { evaluate(uop); }
 
   void decl(DeclStmt *declstmt) {
     // printf("debug decl\n");
@@ -281,25 +405,21 @@ public:
         if (type->isIntegerType() || type->isPointerType()) {
           // Declare `int64_t a = 1` and `int64_t *a = MALLOC(4)` situations.
           if (vardecl->hasInit()) {
-            int64_t val = mStack.back().getStmtVal(vardecl->getInit());
-            mStack.back().bindDecl(vardecl, val);
+            int64_t val = mStack.back()->getStmtVal(vardecl->getInit());
+            *getVarAddr(vardecl) = val;
           } else {
             // Declare `int64_t a` and `int64_t *a` situations and initialize
             // them to 0.
-            mStack.back().bindDecl(vardecl, 0);
+            *getVarAddr(vardecl) = 0;
           }
         }
         // Declare `int a[10]` situation.
         else if (type->isArrayType()) {
-          // Initialze an empty array.
-          const ConstantArrayType *array =
-              dyn_cast<ConstantArrayType>(type.getTypePtr());
-          int size = array->getSize().getSExtValue();
-          int64_t *newArray = new int64_t[size];
-          for (int i = 0; i < size; i++) {
-            newArray[i] = 0;
-          }
-          mStack.back().bindDecl(vardecl, (int64_t)newArray);
+          // Initialze an empty array in the storage reserved by the frame.
+          const VarSlot *slot = mLayout.findVar(vardecl);
+          int64_t *storage = mStack.back()->getArrayStorage(slot->storage);
+          memset(storage, 0, getTypeWidth(type));
+          *getVarAddr(vardecl) = (int64_t)storage;
         } else {
           llvm::errs() << "Unsupported decl type in decl\n";
           declstmt->dump();
@@ -311,32 +431,14 @@ public:
   }
 
   // Bind the stmt of declref, becuase it is viewed as a kind of expressions.
+  // `prepare` resolved it to its variable; functions have nothing to bind.
   void declref(DeclRefExpr *declref) {
-    // printf("debug declref\n");
-    QualType type = declref->getType();
-    if (type->isIntegerType() || type->isPointerType() || type->isArrayType()) {
-      Decl *decl = declref->getFoundDecl();
-      int64_t val;
-      if (mStack.back().hasDecl(decl)) {
-        // Get val from local variables.
-        val = mStack.back().getDeclVal(decl);
-      } else if (gVars.find(decl) != gVars.end()) {
-        // Get val from global variables.
-        val = gVars[decl];
-      } else {
-        llvm::errs() << "Undefined variable in declref\n";
-        declref->dump();
-        type->dump();
-        assert(false);
-      }
-      mStack.back().bindStmt(declref, val);
-    } else if (type->isFunctionProtoType()) {
-      // Just do nothing.
-    } else {
-      llvm::errs() << "Unsupported declref type in declref\n";
-      declref->dump();
-      type->dump();
-    }
+    llvm::DenseMap<const DeclRefExpr *, VarRef>::const_iterator it =
+        mVarRefs.find(declref);
+    if (it == mVarRefs.end())
+      return;
+    const VarRef &ref = it->second;
+    mStack.back()->bindSlot(ref.result, *getVarAddr(ref.var));
   }
 
   // Deal with ImplicitCastExpr.
@@ -346,8 +448,11 @@ public:
     if (type->isIntegerType() ||
         (type->isPointerType() && !type->isFunctionPointerType())) {
       Expr *expr = castexpr->getSubExpr();
-      int64_t val = mStack.back().getStmtVal(expr);
-      mStack.back().bindStmt(castexpr, val);
+      int64_t val = mStack.back()->getStmtVal(expr);
+      // Conversions to characters keep the low byte.
+      if (castexpr->getCastKind() == CK_IntegralCast)
+        val = narrow(getMemKind(type), val);
+      mStack.back()->bindStmt(castexpr, val);
     } else if (type->isFunctionPointerType()) {
       // Just do nothing, since we can catch the function in `enterFunc`.
     } else {
@@ -358,48 +463,565 @@ public:
     }
   }
 
+  // How `call` was resolved by `prepare`.
+  const CallSite &getCallSite(const CallExpr *call) {
+    return mCalls.find(call)->second;
+  }
+
+  // Whether nothing is left to do in the caller once `call` returns. The
+  // callee of such a call takes over the caller's frame.
+  bool isTailCall(CallExpr *call) { return getCallSite(call).tail; }
+  // The tail call whose value `ret` returns, if it returns one.
+  CallExpr *getTailCall(ReturnStmt *ret) {
+    Expr *retexpr = ret->getRetValue();
+    if (!retexpr)
+      return NULL;
+    CallExpr *call = getReturnedCall(retexpr);
+    if (!call || !isTailCall(call))
+      return NULL;
+    return call;
+  }
+
+  // Replace the current StackFrame by one for the callee of the tail call
+  // `site`, so a chain of tail calls runs in constant space.
+  void tailCall(const CallSite &site) {
+    StackFrame *frame = mStack.back();
+    mArgs.resize(site.numArgs);
+    for (unsigned i = 0; i < site.numArgs; i++)
+      mArgs[i] = frame->getSlotVal(mArgSlots[site.firstArg + i]);
+    mFrames.pop(frame);
+    frame = mFrames.push(&mLayout, *site.frame);
+    for (unsigned i = 0; i < site.numArgs; i++)
+      frame->bindDecl(i, mArgs[i]);
+    mStack.back() = frame;
+  }
+
+  // Bind the result of the call `site` if its callee is pure and was called
+  // with the same arguments before.
+  bool memoLookup(const CallSite &site) {
+    if (!site.pure)
+      return false;
+    int64_t args[MEMO_MAX_ARGS];
+    memoArgs(site, args);
+    int64_t result;
+    if (!mMemo.lookup(site.callee, args, result))
+      return false;
+    mStack.back()->bindSlot(site.result, result);
+    return true;
+  }
+  // Remember the result `exitFunc` bound to the call `site`.
+  void memoStore(const CallSite &site) {
+    if (!site.pure)
+      return;
+    int64_t args[MEMO_MAX_ARGS];
+    memoArgs(site, args);
+    mMemo.store(site.callee, args, mStack.back()->getSlotVal(site.result));
+  }
+
   // Create a StackFrame for new function call and declare the input params.
-  void enterFunc(CallExpr *callexpr) {
-    FunctionDecl *callee = callexpr->getDirectCallee();
-    int paramCount = callee->getNumParams();
-    StackFrame newFrame = StackFrame();
-    for (int i = 0; i < paramCount; i++) {
-      newFrame.bindDecl(callee->getParamDecl(i),
-                        mStack.back().getStmtVal(callexpr->getArg(i)));
-    }
+  void enterFunc(const CallSite &site) {
+    StackFrame *caller = mStack.back();
+    StackFrame *newFrame = mFrames.push(&mLayout, *site.frame);
+    // Parameters occupy the first slots, whichever declaration is called.
+    for (unsigned i = 0; i < site.numArgs; i++)
+      newFrame->bindDecl(i, caller->getSlotVal(mArgSlots[site.firstArg + i]));
     mStack.push_back(newFrame);
   }
 
   // Exit the previous function and bind the result to the current function.
-  void exitFunc(CallExpr *callexpr) {
-    int64_t returnValue = mStack.back().getReturnValue();
+  void exitFunc(const CallSite &site) {
+    int64_t returnValue = mStack.back()->getReturnValue();
+    mFrames.pop(mStack.back());
     mStack.pop_back();
-    mStack.back().bindStmt(callexpr, returnValue);
-  }
-
-  // Judge if the function is a builtin function.
-  bool builtinFunc(CallExpr *callexpr) {
-    int64_t val = 0;
-    FunctionDecl *callee = callexpr->getDirectCallee();
-    if (callee == mInput) {
-      llvm::errs() << "Please Input an Integer Value : ";
-      scanf("%ld", &val);
-      mStack.back().bindStmt(callexpr, val);
-    } else if (callee == mOutput) {
-      Expr *decl = callexpr->getArg(0);
-      val = mStack.back().getStmtVal(decl);
-      llvm::errs() << val;
-      mStack.back().bindStmt(callexpr, 0);
-    } else if (callee == mMalloc) {
-      int64_t size = mStack.back().getStmtVal(callexpr->getArg(0));
-      mStack.back().bindStmt(callexpr, reinterpret_cast<int64_t>(malloc(size)));
-    } else if (callee == mFree) {
-      int64_t *ptr = reinterpret_cast<int64_t *>(
-          mStack.back().getStmtVal(callexpr->getArg(0)));
-      free(ptr);
+    mStack.back()->bindSlot(site.result, returnValue);
+  }
+
+  // Run the built-in function the call `site` calls.
+  void builtinFunc(const CallSite &site) {
+    StackFrame *frame = mStack.back();
+    switch (site.builtin) {
+    case BK_Input:
+      frame->bindSlot(site.result, input());
+      break;
+    case BK_Output:
+      output(frame->getSlotVal(mArgSlots[site.firstArg]));
+      frame->bindSlot(site.result, 0);
+      break;
+    case BK_Malloc:
+      frame->bindSlot(site.result,
+                      allocate(frame->getSlotVal(mArgSlots[site.firstArg])));
+      break;
+    case BK_Free:
+      release(frame->getSlotVal(mArgSlots[site.firstArg]));
+      break;
+    default:
+      assert(false);
+    }
+  }
+private:
+  template <MemKind Kind>
+  bool runLoopIdiom(const CountedLoop &loop, int64_t first, uint64_t count,
+                    int64_t value) {
+    int64_t offset = first * memWidth<Kind>();
+    uint64_t size = count * memWidth<Kind>();
+    char *source = NULL;
+    if (loop.source)
+      source = reinterpret_cast<char *>(*getVarAddr(loop.source)) + offset;
+    switch (loop.idiom) {
+    case LI_Fill:
+      fillMem<Kind>(reinterpret_cast<char *>(*getVarAddr(loop.target)) +
+                        offset,
+                    value, count);
+      return true;
+    case LI_Copy: {
+      char *target =
+          reinterpret_cast<char *>(*getVarAddr(loop.target)) + offset;
+      if (target < source + size && source < target + size)
+        return false;
+      memcpy(target, source, size);
+      return true;
+    }
+    default: {
+      int64_t *sum = getVarAddr(loop.target);
+      *sum = (int64_t)((uint64_t)*sum + (uint64_t)sumMem<Kind>(source, count));
+      return true;
+    }
+    }
+  }
+
+  void evaluate(Expr *expr) {
+    const OperatorSite &site = mOperators.find(expr)->second;
+    site.handler(this, site);
+  }
+
+  // Bind every operator under `stmt` that is not folded to its handler.
+  void resolveOperators(Stmt *stmt) {
+    if (!stmt)
+      return;
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+      if (getConstant(expr))
+        return;
+      if (BinaryOperator *bop = dyn_cast<BinaryOperator>(expr)) {
+        OperatorSite site = bindSite(bop, bop->getLHS());
+        site.right = mLayout.getExprSlot(bop->getRHS());
+        site.handler = findBinop(bop);
+        mOperators[bop] = site;
+      } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(expr)) {
+        OperatorSite site = bindSite(uop, uop->getSubExpr());
+        site.handler = findUnaryop(uop);
+        mOperators[uop] = site;
+      } else if (ArraySubscriptExpr *subscript =
+                     dyn_cast<ArraySubscriptExpr>(expr)) {
+        OperatorSite site = bindSite(subscript, subscript->getBase());
+        site.right = mLayout.getExprSlot(subscript->getIdx());
+        site.handler = findSubscript(subscript);
+        mOperators[subscript] = site;
+      } else if (CallExpr *call = dyn_cast<CallExpr>(expr)) {
+        resolveCall(call);
+      } else if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(expr)) {
+        resolveVarRef(declref);
+      }
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      resolveOperators(*it);
+  }
+
+  void findBuiltins(TranslationUnitDecl *unit) {
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+        if (fdecl->getName().equals("FREE"))
+          mFree = fdecl;
+        else if (fdecl->getName().equals("MALLOC"))
+          mMalloc = fdecl;
+        else if (fdecl->getName().equals("GET"))
+          mInput = fdecl;
+        else if (fdecl->getName().equals("PRINT"))
+          mOutput = fdecl;
+        else if (fdecl->getName().equals("main"))
+          mEntry = fdecl;
+      }
+    }
+  }
+
+  void resolveCall(CallExpr *call) {
+    CallSite site;
+    FunctionDecl *callee = call->getDirectCallee();
+    site.builtin = getBuiltinKind(callee);
+    site.callee = NULL;
+    site.body = NULL;
+    site.frame = NULL;
+    if (site.builtin == BK_None && callee && callee->getDefinition()) {
+      site.callee = callee->getDefinition();
+      site.body = site.callee->getBody();
+      site.frame = &mLayout.getFunction(site.callee);
+    }
+    site.result = mLayout.getExprSlot(call);
+    site.firstArg = mArgSlots.size();
+    site.numArgs = call->getNumArgs();
+    for (unsigned i = 0; i < site.numArgs; i++)
+      mArgSlots.push_back(mLayout.getExprSlot(call->getArg(i)));
+    site.tail = false;
+    site.pure = site.callee && isPure(site.callee);
+    mCalls[call] = site;
+  }
+
+  void resolveVarRef(DeclRefExpr *declref) {
+    QualType type = declref->getType();
+    if (type->isIntegerType() || type->isPointerType() || type->isArrayType()) {
+      // The slot was resolved to a local or global one by the Layout.
+      VarRef ref;
+      ref.var = mLayout.findVar(declref->getFoundDecl());
+      if (!ref.var) {
+        llvm::errs() << "Undefined variable in declref\n";
+        declref->dump();
+        type->dump();
+        assert(false);
+      }
+      ref.result = mLayout.getExprSlot(declref);
+      mVarRefs[declref] = ref;
+    } else if (!type->isFunctionProtoType()) {
+      llvm::errs() << "Unsupported declref type in declref\n";
+      declref->dump();
+      type->dump();
+    }
+  }
+
+  void memoArgs(const CallSite &site, int64_t *args) {
+    for (unsigned i = 0; i < MEMO_MAX_ARGS; i++)
+      args[i] = i < site.numArgs ? mStack.back()->getSlotVal(
+                                       mArgSlots[site.firstArg + i])
+                                 : 0;
+  }
+
+  // The call `retexpr` returns the value of unchanged, if it is one. Casts
+  // that narrow or otherwise change the value still have work to do after
+  // the call.
+  static CallExpr *getReturnedCall(Expr *retexpr) {
+    Expr *expr = retexpr->IgnoreParens();
+    while (ImplicitCastExpr *cast = dyn_cast<ImplicitCastExpr>(expr)) {
+      CastKind kind = cast->getCastKind();
+      if ((kind != CK_NoOp && kind != CK_BitCast &&
+           kind != CK_IntegralCast) ||
+          getMemKind(cast->getType()) !=
+              getMemKind(cast->getSubExpr()->getType()))
+        return NULL;
+      expr = cast->getSubExpr()->IgnoreParens();
+    }
+    return dyn_cast<CallExpr>(expr);
+  }
+
+  // Record the calls under `stmt` after which `function` has nothing left
+  // to do: calls whose value is returned, and, in a function returning
+  // nothing, calls that are the last statement to run. Only calls to
+  // interpreted functions qualify; built-ins have no frame to reuse.
+  void findTailCalls(Stmt *stmt, bool tail, FunctionDecl *function) {
+    if (!stmt)
+      return;
+    if (ReturnStmt *ret = dyn_cast<ReturnStmt>(stmt)) {
+      if (Expr *retexpr = ret->getRetValue())
+        addTailCall(getReturnedCall(retexpr), function);
+      return;
+    }
+    if (isa<Expr>(stmt)) {
+      if (tail && function->getReturnType()->isVoidType())
+        addTailCall(dyn_cast<CallExpr>(stmt), function);
+      return;
+    }
+    if (CompoundStmt *compound = dyn_cast<CompoundStmt>(stmt)) {
+      for (CompoundStmt::body_iterator it = compound->body_begin(),
+                                       ie = compound->body_end();
+           it != ie; ++it)
+        findTailCalls(*it, tail && *it == compound->body_back(), function);
+    } else if (IfStmt *ifstmt = dyn_cast<IfStmt>(stmt)) {
+      findTailCalls(ifstmt->getThen(), tail, function);
+      findTailCalls(ifstmt->getElse(), tail, function);
     } else {
-      return false;
+      // Nothing in a loop body is the last thing to run.
+      for (Stmt::child_iterator it = stmt->child_begin(),
+                                ie = stmt->child_end();
+           it != ie; ++it)
+        findTailCalls(*it, false, function);
+    }
+  }
+  // A function with local arrays may pass them to the callee, whose frame
+  // would then take over their memory.
+  void addTailCall(CallExpr *call, FunctionDecl *function) {
+    if (!call || mLayout.getFunction(function).numArrayWords)
+      return;
+    CallSite &site = mCalls.find(call)->second;
+    if (site.callee)
+      site.tail = true;
+  }
+
+  OperatorSite bindSite(Expr *expr, Expr *left) {
+    OperatorSite site;
+    site.handler = NULL;
+    site.result = mLayout.getExprSlot(expr);
+    site.right = 0;
+    // An operand that is written to is addressed through its own slot, or
+    // through the variable it names.
+    site.var = NULL;
+    left = left->IgnoreParens();
+    if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(left))
+      site.var = mLayout.findVar(declref->getFoundDecl());
+    site.left = mLayout.getExprSlot(left);
+    return site;
+  }
+
+  template <BinaryOperatorKind Opc>
+  static int64_t apply(int64_t left, int64_t right) {
+    switch (Opc) {
+    case BO_Add:
+      return left + right;
+    case BO_Sub:
+      return left - right;
+    case BO_Mul:
+      return left * right;
+    case BO_Div:
+      return left / right;
+    case BO_EQ:
+      return left == right;
+    case BO_NE:
+      return left != right;
+    case BO_LT:
+      return left < right;
+    case BO_GT:
+      return left > right;
+    case BO_LE:
+      return left <= right;
+    default:
+      return left >= right;
+    }
+  }
+
+  // `left op right`, where an integer added to a pointer to words is scaled
+  // by the size of a word.
+  template <BinaryOperatorKind Opc, int64_t LeftScale, int64_t RightScale>
+  static void arith(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    int64_t left = frame->getSlotVal(site.left) * LeftScale;
+    int64_t right = frame->getSlotVal(site.right) * RightScale;
+    frame->bindSlot(site.result, apply<Opc>(left, right));
+  }
+
+  // The storage an assignment or increment writes to: a variable, or the
+  // address bound by a `*p` or `a[i]` operand.
+  template <bool ToVar>
+  static int64_t *target(Environment *env, const OperatorSite &site) {
+    if (!ToVar)
+      return env->mStack.back()->getSlotPtr(site.left);
+    if (site.var->global)
+      return &env->gVars[site.var->index];
+    return env->mStack.back()->getDeclAddr(site.var->index);
+  }
+
+  // The number of elements between two pointers to words.
+  static void difference(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    int64_t bytes =
+        frame->getSlotVal(site.left) - frame->getSlotVal(site.right);
+    frame->bindSlot(site.result, bytes / (int64_t)sizeof(int64_t));
+  }
+
+  // Variables hold words; memory is written as a `Kind`.
+  template <bool ToVar, MemKind Kind>
+  static void assign(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    int64_t rightValue = narrow<Kind>(frame->getSlotVal(site.right));
+    int64_t *addr = target<ToVar>(env, site);
+    if (ToVar)
+      *addr = rightValue;
+    else
+      storeMem<Kind>(addr, rightValue);
+    frame->bindSlot(site.result, rightValue);
+  }
+
+  template <UnaryOperatorKind Opc>
+  static void unaryArith(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    int64_t value = frame->getSlotVal(site.left);
+    int64_t result;
+    switch (Opc) {
+    case UO_Minus:
+      result = -value;
+      break;
+    case UO_Not:
+      result = ~value;
+      break;
+    case UO_LNot:
+      result = !value;
+      break;
+    default:
+      result = value;
+    }
+    frame->bindSlot(site.result, result);
+  }
+
+  template <MemKind Kind>
+  static void deref(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    int64_t *ptr = (int64_t *)frame->getSlotVal(site.left);
+    frame->bindSlotPtr(site.result, ptr);
+    frame->bindSlot(site.result, loadMem<Kind>(ptr));
+  }
+
+  // `base[index]`, an element of `Kind`.
+  template <MemKind Kind>
+  static void subscript(Environment *env, const OperatorSite &site) {
+    StackFrame *frame = env->mStack.back();
+    char *base = (char *)frame->getSlotVal(site.left);
+    int64_t *ptr = (int64_t *)(base + frame->getSlotVal(site.right) *
+                                          memWidth<Kind>());
+    frame->bindSlotPtr(site.result, ptr);
+    frame->bindSlot(site.result, loadMem<Kind>(ptr));
+  }
+
+  // `++` and `--` of a variable or of memory holding a `Kind`. Pointers to
+  // words step by a whole word.
+  template <int64_t Step, bool Prefix, bool ToVar, MemKind Kind>
+  static void increment(Environment *env, const OperatorSite &site) {
+    int64_t *addr = target<ToVar>(env, site);
+    int64_t old = ToVar ? *addr : loadMem<Kind>(addr);
+    int64_t updated = narrow<Kind>(old + Step);
+    if (ToVar)
+      *addr = updated;
+    else
+      storeMem<Kind>(addr, updated);
+    env->mStack.back()->bindSlot(site.result, Prefix ? updated : old);
+  }
+  template <int64_t Step, bool Prefix>
+  static OperatorHandler findIncrement(bool toVar, MemKind kind) {
+    switch (kind) {
+    case MK_Byte:
+      return toVar ? &increment<Step, Prefix, true, MK_Byte>
+                   : &increment<Step, Prefix, false, MK_Byte>;
+    case MK_UByte:
+      return toVar ? &increment<Step, Prefix, true, MK_UByte>
+                   : &increment<Step, Prefix, false, MK_UByte>;
+    default:
+      return toVar ? &increment<Step, Prefix, true, MK_Word>
+                   : &increment<Step, Prefix, false, MK_Word>;
+    }
+  }
+
+  static OperatorHandler findBinop(BinaryOperator *bop) {
+    Expr *left = bop->getLHS()->IgnoreParens();
+    BinaryOperatorKind opc = bop->getOpcode();
+    if (opc == BO_Assign) {
+      MemKind kind = getMemKind(left->getType());
+      if (isa<DeclRefExpr>(left))
+        return kind == MK_Byte    ? &assign<true, MK_Byte>
+               : kind == MK_UByte ? &assign<true, MK_UByte>
+                                  : &assign<true, MK_Word>;
+      // Deal with `*a = 1` and `a[0] = 1` situations.
+      if (isa<UnaryOperator>(left) || isa<ArraySubscriptExpr>(left))
+        return kind == MK_Byte    ? &assign<false, MK_Byte>
+               : kind == MK_UByte ? &assign<false, MK_UByte>
+                                  : &assign<false, MK_Word>;
+      llvm::errs() << "Unsupported left value type in binop\n";
+      bop->dump();
+      assert(false);
+      return NULL;
+    }
+
+    struct Entry {
+      BinaryOperatorKind opc;
+      OperatorHandler intInt, ptrInt, intPtr;
+    };
+    static const int64_t S = sizeof(int64_t);
+    static const Entry table[] = {
+        {BO_Add, &arith<BO_Add, 1, 1>, &arith<BO_Add, 1, S>,
+         &arith<BO_Add, S, 1>},
+        {BO_Sub, &arith<BO_Sub, 1, 1>, &arith<BO_Sub, 1, S>, NULL},
+        {BO_Mul, &arith<BO_Mul, 1, 1>, NULL, NULL},
+        {BO_Div, &arith<BO_Div, 1, 1>, NULL, NULL},
+        {BO_EQ, &arith<BO_EQ, 1, 1>, NULL, NULL},
+        {BO_NE, &arith<BO_NE, 1, 1>, NULL, NULL},
+        {BO_LT, &arith<BO_LT, 1, 1>, NULL, NULL},
+        {BO_GT, &arith<BO_GT, 1, 1>, NULL, NULL},
+        {BO_LE, &arith<BO_LE, 1, 1>, NULL, NULL},
+        {BO_GE, &arith<BO_GE, 1, 1>, NULL, NULL},
+    };
+    // Pointers to characters step by bytes, just like integers do.
+    bool leftPtr = isWordPointer(left->getType());
+    bool rightPtr = isWordPointer(bop->getRHS()->getType());
+    if (opc == BO_Sub && leftPtr && rightPtr)
+      return &difference;
+    OperatorHandler handler = NULL;
+    for (size_t i = 0; i < sizeof(table) / sizeof(table[0]); i++) {
+      if (table[i].opc != opc)
+        continue;
+      // Comparisons and differences of two pointers are plain integer ones.
+      if (leftPtr && !rightPtr)
+        handler = table[i].ptrInt;
+      else if (!leftPtr && rightPtr)
+        handler = table[i].intPtr;
+      else
+        handler = table[i].intInt;
+    }
+    if (!handler) {
+      llvm::errs() << "Unsupported operation in binop\n";
+      bop->dump();
+      assert(false);
+    }
+    return handler;
+  }
+
+  static OperatorHandler findUnaryop(UnaryOperator *uop) {
+    switch (uop->getOpcode()) {
+    case UO_Plus:
+      return &unaryArith<UO_Plus>;
+    case UO_Minus:
+      return &unaryArith<UO_Minus>;
+    case UO_Not:
+      return &unaryArith<UO_Not>;
+    case UO_LNot:
+      return &unaryArith<UO_LNot>;
+    case UO_Deref:
+      switch (getMemKind(uop->getType())) {
+      case MK_Byte:
+        return &deref<MK_Byte>;
+      case MK_UByte:
+        return &deref<MK_UByte>;
+      default:
+        return &deref<MK_Word>;
+      }
+    default:
+      break;
+    }
+    if (uop->isIncrementDecrementOp()) {
+      static const int64_t S = sizeof(int64_t);
+      typedef OperatorHandler (*Finder)(bool, MemKind);
+      // Indexed by [pointer to words][decrement][prefix].
+      static const Finder table[2][2][2] = {
+          {{&findIncrement<1, false>, &findIncrement<1, true>},
+           {&findIncrement<-1, false>, &findIncrement<-1, true>}},
+          {{&findIncrement<S, false>, &findIncrement<S, true>},
+           {&findIncrement<-S, false>, &findIncrement<-S, true>}}};
+      Expr *sub = uop->getSubExpr()->IgnoreParens();
+      if (isa<DeclRefExpr>(sub) || isa<UnaryOperator>(sub) ||
+          isa<ArraySubscriptExpr>(sub))
+        return table[isWordPointer(uop->getType())][uop->isDecrementOp()]
+                    [uop->isPrefix()](isa<DeclRefExpr>(sub),
+                                      getMemKind(uop->getType()));
+    }
+    llvm::errs() << "Unsupported operation in unaryop\n";
+    uop->dump();
+    assert(false);
+    return NULL;
+  }
+
+  static OperatorHandler findSubscript(ArraySubscriptExpr *expr) {
+    switch (getMemKind(expr->getType())) {
+    case MK_Byte:
+      return &subscript<MK_Byte>;
+    case MK_UByte:
+      return &subscript<MK_UByte>;
+    default:
+      return &subscript<MK_Word>;
     }
-    return true;
   }
 };
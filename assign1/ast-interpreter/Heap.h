@@ -0,0 +1,133 @@
+//==--- Heap.h - Heap of the interpreted program --------------------------===//
+//===----------------------------------------------------------------------===//
+#include <stdint.h>
+#include <stdlib.h>
+
+#include <vector>
+
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/raw_ostream.h"
+
+// Heap serves MALLOC and FREE of the interpreted program. Small blocks are
+// carved out of large chunks and recycled through one free list per size
+// class; larger ones go to malloc. Whatever the program leaks is released at
+// once when the Heap is destroyed.
+class Heap {
+  // Every block is preceded by a header, which keeps blocks 16-byte aligned.
+  struct Header {
+    // The size the program asked for.
+    uint64_t size;
+    // The next free block of the same class, while the block is free.
+    Header *next;
+  };
+
+  static const size_t GRANULE = 16;
+  static const size_t NUM_CLASSES = 64;
+  // Blocks of up to MAX_SMALL bytes are pooled.
+  static const size_t MAX_SMALL = GRANULE * NUM_CLASSES;
+  static const size_t CHUNK_SIZE = 64 << 10;
+
+  Header *mFree[NUM_CLASSES];
+  std::vector<char *> mChunks;
+  char *mCursor;
+  char *mChunkEnd;
+  llvm::DenseSet<Header *> mLarge;
+
+  uint64_t mNumAllocs;
+  uint64_t mNumFrees;
+  uint64_t mTotalBytes;
+  uint64_t mLiveBlocks;
+  uint64_t mLiveBytes;
+  uint64_t mPeakBytes;
+
+  Heap(const Heap &) = delete;
+  Heap &operator=(const Heap &) = delete;
+
+public:
+  Heap()
+      : mCursor(NULL), mChunkEnd(NULL), mNumAllocs(0), mNumFrees(0),
+        mTotalBytes(0), mLiveBlocks(0), mLiveBytes(0), mPeakBytes(0) {
+    for (size_t i = 0; i < NUM_CLASSES; i++)
+      mFree[i] = NULL;
+  }
+  ~Heap() {
+    for (size_t i = 0; i < mChunks.size(); i++)
+      free(mChunks[i]);
+    for (llvm::DenseSet<Header *>::iterator it = mLarge.begin(),
+                                            ie = mLarge.end();
+         it != ie; ++it)
+      free(*it);
+  }
+
+  void *allocate(uint64_t size) {
+    Header *header;
+    if (size <= MAX_SMALL) {
+      size_t cls = sizeClass(size);
+      header = mFree[cls];
+      if (header)
+        mFree[cls] = header->next;
+      else
+        header = carve(sizeof(Header) + (cls + 1) * GRANULE);
+      if (!header)
+        return NULL;
+    } else {
+      header = static_cast<Header *>(malloc(sizeof(Header) + size));
+      if (!header)
+        return NULL;
+      mLarge.insert(header);
+    }
+    header->size = size;
+    mNumAllocs++;
+    mTotalBytes += size;
+    mLiveBlocks++;
+    mLiveBytes += size;
+    if (mLiveBytes > mPeakBytes)
+      mPeakBytes = mLiveBytes;
+    return header + 1;
+  }
+
+  void release(void *ptr) {
+    if (!ptr)
+      return;
+    Header *header = static_cast<Header *>(ptr) - 1;
+    uint64_t size = header->size;
+    mNumFrees++;
+    mLiveBlocks--;
+    mLiveBytes -= size;
+    if (size <= MAX_SMALL) {
+      size_t cls = sizeClass(size);
+      header->next = mFree[cls];
+      mFree[cls] = header;
+    } else {
+      mLarge.erase(header);
+      free(header);
+    }
+  }
+
+  // Print what the program allocated, at its peak, and what it leaked.
+  void printStats(llvm::raw_ostream &os) const {
+    os << "heap: allocs " << mNumAllocs << " frees " << mNumFrees << " bytes "
+       << mTotalBytes << " peak " << mPeakBytes << " leaked-blocks "
+       << mLiveBlocks << " leaked-bytes " << mLiveBytes << "\n";
+  }
+
+private:
+  // Blocks of class `c` hold up to (c + 1) * GRANULE bytes.
+  static size_t sizeClass(uint64_t size) {
+    return size ? (size - 1) / GRANULE : 0;
+  }
+
+  Header *carve(size_t size) {
+    if ((size_t)(mChunkEnd - mCursor) < size) {
+      char *chunk = static_cast<char *>(malloc(CHUNK_SIZE));
+      if (!chunk)
+        return NULL;
+      mChunks.push_back(chunk);
+      mCursor = chunk;
+      mChunkEnd = chunk + CHUNK_SIZE;
+    }
+    Header *header = reinterpret_cast<Header *>(mCursor);
+    mCursor += size;
+    return header;
+  }
+};
@@ -0,0 +1,173 @@
+//==--- IO.h - Buffered input and output of the interpreted program -------===//
+//===----------------------------------------------------------------------===//
+#include <fcntl.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#include <string>
+
+// IOChannel carries what PRINT writes and GET reads. Output collects in a
+// large buffer that is written out when it fills up, before the program
+// waits for input, and when the channel is flushed or destroyed. Input is
+// read in large blocks and parsed in place. Both sides can also be kept in
+// memory instead of a file.
+class IOChannel {
+  static const size_t BUFFER_SIZE = 1 << 16;
+
+  int mOutFd;
+  // Receives the output instead of mOutFd if set.
+  std::string *mOutString;
+  char mOut[BUFFER_SIZE];
+  size_t mOutLen;
+
+  // -1 once the input is all in mInData.
+  int mInFd;
+  char mIn[BUFFER_SIZE];
+  const char *mInData;
+  size_t mInPos;
+  size_t mInEnd;
+  bool mPrompt;
+
+  IOChannel(const IOChannel &) = delete;
+  IOChannel &operator=(const IOChannel &) = delete;
+
+public:
+  // PRINT goes to stderr and GET prompts and reads stdin by default.
+  IOChannel()
+      : mOutFd(STDERR_FILENO), mOutString(NULL), mOutLen(0),
+        mInFd(STDIN_FILENO), mInData(mIn), mInPos(0), mInEnd(0),
+        mPrompt(true) {}
+  ~IOChannel() {
+    flush();
+    closeInput();
+  }
+
+  void setOutput(int fd) {
+    flush();
+    mOutFd = fd;
+    mOutString = NULL;
+  }
+  // Append the output to `out`.
+  void setOutput(std::string *out) {
+    flush();
+    mOutString = out;
+  }
+  void setPrompt(bool prompt) { mPrompt = prompt; }
+  // Read GET values from the file at `path`; false if it cannot be opened.
+  bool setInput(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0)
+      return false;
+    closeInput();
+    mInFd = fd;
+    mInData = mIn;
+    mInPos = mInEnd = 0;
+    return true;
+  }
+  // Read GET values from `data`, which must outlive the channel.
+  void setInput(const char *data, size_t len) {
+    closeInput();
+    mInFd = -1;
+    mInData = data;
+    mInPos = 0;
+    mInEnd = len;
+  }
+
+  void write(const char *data, size_t len) {
+    if (mOutLen + len > BUFFER_SIZE) {
+      flush();
+      if (len > BUFFER_SIZE) {
+        writeAll(data, len);
+        return;
+      }
+    }
+    memcpy(mOut + mOutLen, data, len);
+    mOutLen += len;
+  }
+
+  void print(int64_t val) {
+    // Digits are produced backwards from the end of `buf`.
+    char buf[24];
+    char *end = buf + sizeof(buf);
+    char *p = end;
+    uint64_t mag = val < 0 ? -(uint64_t)val : (uint64_t)val;
+    do {
+      *--p = '0' + mag % 10;
+      mag /= 10;
+    } while (mag);
+    if (val < 0)
+      *--p = '-';
+    write(p, end - p);
+  }
+
+  // Parse the next integer like scanf("%ld"): leading whitespace is
+  // skipped, and 0 is returned without consuming anything if no number
+  // follows.
+  int64_t readInt() {
+    if (mPrompt) {
+      static const char prompt[] = "Please Input an Integer Value : ";
+      write(prompt, sizeof(prompt) - 1);
+    }
+    int c = peek();
+    while (c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\v' ||
+           c == '\f') {
+      mInPos++;
+      c = peek();
+    }
+    bool negative = false;
+    if (c == '-' || c == '+') {
+      negative = c == '-';
+      mInPos++;
+      c = peek();
+    }
+    uint64_t val = 0;
+    while (c >= '0' && c <= '9') {
+      val = val * 10 + (c - '0');
+      mInPos++;
+      c = peek();
+    }
+    return negative ? -(int64_t)val : (int64_t)val;
+  }
+
+  void flush() {
+    writeAll(mOut, mOutLen);
+    mOutLen = 0;
+  }
+
+private:
+  // The next input character, or -1 at the end of the input.
+  int peek() {
+    if (mInPos == mInEnd) {
+      if (mInFd < 0)
+        return -1;
+      // Whoever waits for this input should see everything printed so far.
+      flush();
+      ssize_t len = read(mInFd, mIn, BUFFER_SIZE);
+      if (len <= 0)
+        return -1;
+      mInPos = 0;
+      mInEnd = len;
+    }
+    return (unsigned char)mInData[mInPos];
+  }
+
+  void closeInput() {
+    if (mInFd > STDIN_FILENO)
+      close(mInFd);
+  }
+
+  void writeAll(const char *data, size_t len) {
+    if (mOutString) {
+      mOutString->append(data, len);
+      return;
+    }
+    while (len) {
+      ssize_t written = ::write(mOutFd, data, len);
+      if (written <= 0)
+        return;
+      data += written;
+      len -= written;
+    }
+  }
+};
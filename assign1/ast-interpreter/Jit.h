@@ -0,0 +1,492 @@
+//==--- Jit.h - Native compilation of hot bytecode functions --------------===//
+//===----------------------------------------------------------------------===//
+#include <stdint.h>
+
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "llvm/ExecutionEngine/Orc/ExecutionUtils.h"
+#include "llvm/ExecutionEngine/Orc/LLJIT.h"
+#include "llvm/IR/IRBuilder.h"
+#include "llvm/IR/LLVMContext.h"
+#include "llvm/IR/LegacyPassManager.h"
+#include "llvm/IR/Module.h"
+#include "llvm/Support/TargetSelect.h"
+#include "llvm/Transforms/IPO/PassManagerBuilder.h"
+
+// The calling convention of native code. A call starts with `entry` 0 and
+// its arguments in `regs`. The interpreter can also move a running frame to
+// native code at the head of a loop: `entry` is then the bytecode index of
+// that head, `regs` the whole register file of the frame and `arrays` its
+// local arrays, which stay owned by the interpreter.
+typedef int64_t (*NativeFunction)(void *vm, int64_t *regs, int64_t *arrays,
+                                  int64_t entry);
+
+// What native code calls back into. Every call goes through `call`, which
+// picks native code or the interpreter for the callee and handles
+// memoization, so compiled and interpreted functions can call each other in
+// any order. Values and pointers are the same int64_t words the interpreter
+// uses, so globals, local arrays and the MALLOC heap are shared as they are.
+struct JitRuntime {
+  void *env;
+  int64_t (*call)(void *vm, int64_t index, int64_t *args);
+  int64_t *(*allocArrays)(void *vm, int64_t size);
+  void (*releaseArrays)(void *vm, int64_t *arrays);
+  int64_t (*input)(void *env);
+  void (*output)(void *env, int64_t val);
+  int64_t (*allocate)(void *env, int64_t size);
+  void (*release)(void *env, int64_t ptr);
+};
+
+// JitCompiler lowers a BytecodeFunction to LLVM IR, one function per
+// module, and compiles it with ORC's LLJIT. Bytecode registers become
+// stack slots that the optimizer promotes to SSA values.
+class JitCompiler {
+  std::unique_ptr<llvm::orc::LLJIT> mJIT;
+  JitRuntime mRuntime;
+
+  // State of the function being lowered.
+  llvm::LLVMContext *mContext;
+  llvm::IRBuilder<> *mBuilder;
+  std::vector<llvm::Value *> mRegs;
+  std::vector<llvm::BasicBlock *> mBlocks;
+
+public:
+  explicit JitCompiler(const JitRuntime &runtime)
+      : mRuntime(runtime), mContext(NULL), mBuilder(NULL) {}
+
+  // Compile the function numbered `index`; NULL if LLVM fails.
+  NativeFunction compile(const BytecodeFunction &func, unsigned index) {
+    if (!mJIT) {
+      llvm::Expected<std::unique_ptr<llvm::orc::LLJIT>> jit =
+          llvm::orc::LLJITBuilder().create();
+      if (!jit) {
+        report(jit.takeError());
+        return NULL;
+      }
+      mJIT = std::move(*jit);
+      // Lowered array initialization calls memset.
+      llvm::Expected<std::unique_ptr<llvm::orc::DynamicLibrarySearchGenerator>>
+          process = llvm::orc::DynamicLibrarySearchGenerator::
+              GetForCurrentProcess(mJIT->getDataLayout().getGlobalPrefix());
+      if (!process) {
+        report(process.takeError());
+        return NULL;
+      }
+      mJIT->getMainJITDylib().addGenerator(std::move(*process));
+    }
+    std::unique_ptr<llvm::LLVMContext> context(new llvm::LLVMContext());
+    std::string name = "bytecode" + std::to_string(index);
+    std::unique_ptr<llvm::Module> module(new llvm::Module(name, *context));
+    module->setDataLayout(mJIT->getDataLayout());
+    lower(func, index, name, *module);
+    optimize(*module);
+    if (llvm::Error error = mJIT->addIRModule(llvm::orc::ThreadSafeModule(
+            std::move(module), std::move(context)))) {
+      report(std::move(error));
+      return NULL;
+    }
+    llvm::Expected<llvm::JITEvaluatedSymbol> symbol = mJIT->lookup(name);
+    if (!symbol) {
+      report(symbol.takeError());
+      return NULL;
+    }
+    return reinterpret_cast<NativeFunction>(symbol->getAddress());
+  }
+
+private:
+  static void report(llvm::Error error) {
+    llvm::logAllUnhandledErrors(std::move(error), llvm::errs(), "JIT: ");
+  }
+
+  void lower(const BytecodeFunction &func, unsigned index,
+             const std::string &name, llvm::Module &module) {
+    llvm::LLVMContext &context = module.getContext();
+    llvm::IRBuilder<> builder(context);
+    mContext = &context;
+    mBuilder = &builder;
+    llvm::Type *i8 = builder.getInt8Ty();
+    llvm::Type *i64 = builder.getInt64Ty();
+    llvm::Type *ptr = i64->getPointerTo();
+    llvm::Type *params[] = {builder.getInt8PtrTy(), ptr, ptr, i64};
+    llvm::Function *function = llvm::Function::Create(
+        llvm::FunctionType::get(i64, params, false),
+        llvm::Function::ExternalLinkage, name, &module);
+    llvm::Function::arg_iterator arg = function->arg_begin();
+    llvm::Value *vm = &*arg++;
+    llvm::Value *regs = &*arg++;
+    llvm::Value *arrays = &*arg++;
+    llvm::Value *entry = &*arg;
+
+    // One block per jump target and per instruction after a jump or return.
+    const std::vector<Instr> &code = func.code;
+    mBlocks.assign(code.size() + 1, NULL);
+    mBlocks[0] = llvm::BasicBlock::Create(context, "", function);
+    std::vector<unsigned> loopHeads;
+    unsigned maxArgs = 0;
+    for (size_t pc = 0; pc < code.size(); pc++) {
+      const Instr &I = code[pc];
+      if (isJump(I.op)) {
+        if (!mBlocks[I.imm])
+          mBlocks[I.imm] = llvm::BasicBlock::Create(context, "", function);
+        if (I.c)
+          loopHeads.push_back(I.imm);
+      }
+      if ((isJump(I.op) || isExit(I.op)) && !mBlocks[pc + 1])
+        mBlocks[pc + 1] = llvm::BasicBlock::Create(context, "", function);
+      if ((I.op == OP_Call || I.op == OP_TailCall) && I.imm > maxArgs)
+        maxArgs = I.imm;
+    }
+
+    llvm::BasicBlock *prologue =
+        llvm::BasicBlock::Create(context, "", function, mBlocks[0]);
+    builder.SetInsertPoint(prologue);
+    mRegs.clear();
+    for (unsigned i = 0; i < func.numRegs; i++)
+      mRegs.push_back(builder.CreateAlloca(i64));
+    llvm::Value *arraysSlot = builder.CreateAlloca(ptr);
+    llvm::Value *ownSlot = builder.CreateAlloca(builder.getInt1Ty());
+    llvm::Value *argsBuf =
+        builder.CreateAlloca(i64, builder.getInt32(std::max(maxArgs, 1u)));
+
+    // A call loads its arguments, sets up the constants and allocates its
+    // arrays.
+    llvm::BasicBlock *start = llvm::BasicBlock::Create(context, "", function,
+                                                       mBlocks[0]);
+    llvm::SwitchInst *dispatch =
+        builder.CreateSwitch(entry, start, loopHeads.size());
+    builder.SetInsertPoint(start);
+    for (unsigned i = 0; i < func.numParams; i++)
+      setReg(i, builder.CreateLoad(i64, builder.CreateGEP(
+                                            i64, regs, builder.getInt64(i))));
+    for (size_t i = 0; i < func.consts.size(); i++)
+      setReg(func.consts[i].first, builder.getInt64(func.consts[i].second));
+    builder.CreateStore(builder.getInt1(func.numArrayWords != 0), ownSlot);
+    if (func.numArrayWords)
+      builder.CreateStore(callRuntime(mRuntime.allocArrays, ptr,
+                                      {vm, i64Const(func.numArrayWords)}),
+                          arraysSlot);
+    else
+      builder.CreateStore(llvm::ConstantPointerNull::get(
+                              llvm::cast<llvm::PointerType>(ptr)),
+                          arraysSlot);
+    builder.CreateBr(mBlocks[0]);
+
+    // Entering at a loop head takes over the interpreted frame.
+    for (size_t i = 0; i < loopHeads.size(); i++) {
+      unsigned head = loopHeads[i];
+      llvm::ConstantInt *caseValue = builder.getInt64(head);
+      if (dispatch->findCaseValue(caseValue) != dispatch->case_default())
+        continue;
+      llvm::BasicBlock *osr =
+          llvm::BasicBlock::Create(context, "", function, mBlocks[0]);
+      dispatch->addCase(caseValue, osr);
+      builder.SetInsertPoint(osr);
+      for (unsigned r = 0; r < func.numRegs; r++)
+        setReg(r, builder.CreateLoad(i64, builder.CreateGEP(
+                                              i64, regs, builder.getInt64(r))));
+      builder.CreateStore(builder.getInt1(false), ownSlot);
+      builder.CreateStore(arrays, arraysSlot);
+      builder.CreateBr(mBlocks[head]);
+    }
+
+    builder.SetInsertPoint(mBlocks[0]);
+    for (size_t pc = 0; pc < code.size(); pc++) {
+      if (pc && mBlocks[pc]) {
+        if (!builder.GetInsertBlock()->getTerminator())
+          builder.CreateBr(mBlocks[pc]);
+        builder.SetInsertPoint(mBlocks[pc]);
+      }
+      const Instr &I = code[pc];
+      switch (I.op) {
+      case OP_Const:
+        setReg(I.a, builder.getInt64(I.imm));
+        break;
+      case OP_Mov:
+        setReg(I.a, reg(I.b));
+        break;
+      case OP_Add:
+        setReg(I.a, builder.CreateAdd(reg(I.b), reg(I.c)));
+        break;
+      case OP_Sub:
+        setReg(I.a, builder.CreateSub(reg(I.b), reg(I.c)));
+        break;
+      case OP_Mul:
+        setReg(I.a, builder.CreateMul(reg(I.b), reg(I.c)));
+        break;
+      case OP_Div:
+        setReg(I.a, builder.CreateSDiv(reg(I.b), reg(I.c)));
+        break;
+      case OP_EQ:
+      case OP_NE:
+      case OP_LT:
+      case OP_GT:
+      case OP_LE:
+      case OP_GE:
+        setReg(I.a, builder.CreateZExt(compare(I.op, reg(I.b), reg(I.c)), i64));
+        break;
+      case OP_AddImm:
+        setReg(I.a, builder.CreateAdd(reg(I.b), builder.getInt64(I.imm)));
+        break;
+      case OP_PtrAdd:
+      case OP_PtrSub: {
+        llvm::Value *offset =
+            builder.CreateMul(reg(I.c), builder.getInt64(sizeof(int64_t)));
+        setReg(I.a, I.op == OP_PtrAdd ? builder.CreateAdd(reg(I.b), offset)
+                                      : builder.CreateSub(reg(I.b), offset));
+        break;
+      }
+      case OP_Neg:
+        setReg(I.a, builder.CreateNeg(reg(I.b)));
+        break;
+      case OP_Not:
+        setReg(I.a, builder.CreateNot(reg(I.b)));
+        break;
+      case OP_LNot:
+        setReg(I.a, builder.CreateZExt(
+                        builder.CreateICmpEQ(reg(I.b), builder.getInt64(0)),
+                        i64));
+        break;
+      case OP_SExtB:
+        setReg(I.a, builder.CreateSExt(builder.CreateTrunc(reg(I.b), i8), i64));
+        break;
+      case OP_ZExtB:
+        setReg(I.a, builder.CreateZExt(builder.CreateTrunc(reg(I.b), i8), i64));
+        break;
+      case OP_Load:
+        setReg(I.a, builder.CreateLoad(i64, address(reg(I.b))));
+        break;
+      case OP_LoadB:
+        setReg(I.a, builder.CreateSExt(
+                        builder.CreateLoad(i8, byteAddress(reg(I.b))), i64));
+        break;
+      case OP_LoadUB:
+        setReg(I.a, builder.CreateZExt(
+                        builder.CreateLoad(i8, byteAddress(reg(I.b))), i64));
+        break;
+      case OP_Store:
+        builder.CreateStore(reg(I.b), address(reg(I.a)));
+        break;
+      case OP_StoreB:
+        builder.CreateStore(builder.CreateTrunc(reg(I.b), i8),
+                            byteAddress(reg(I.a)));
+        break;
+      case OP_LoadIdx:
+        setReg(I.a, builder.CreateLoad(
+                        i64, builder.CreateGEP(i64, address(reg(I.b)),
+                                               reg(I.c))));
+        break;
+      case OP_LoadIdxB:
+      case OP_LoadIdxUB: {
+        llvm::Value *byte = builder.CreateLoad(
+            i8, builder.CreateGEP(i8, byteAddress(reg(I.b)), reg(I.c)));
+        setReg(I.a, I.op == OP_LoadIdxB ? builder.CreateSExt(byte, i64)
+                                        : builder.CreateZExt(byte, i64));
+        break;
+      }
+      case OP_StoreIdx:
+        builder.CreateStore(reg(I.c), builder.CreateGEP(i64, address(reg(I.a)),
+                                                        reg(I.b)));
+        break;
+      case OP_StoreIdxB:
+        builder.CreateStore(
+            builder.CreateTrunc(reg(I.c), i8),
+            builder.CreateGEP(i8, byteAddress(reg(I.a)), reg(I.b)));
+        break;
+      case OP_LoadGlobal:
+        setReg(I.a, builder.CreateLoad(i64, address(builder.getInt64(I.imm))));
+        break;
+      case OP_StoreGlobal:
+        builder.CreateStore(reg(I.b), address(builder.getInt64(I.imm)));
+        break;
+      case OP_Alloca: {
+        llvm::Value *array =
+            builder.CreateGEP(i64, builder.CreateLoad(ptr, arraysSlot),
+                              builder.getInt64(I.imm));
+        builder.CreateMemSet(array, builder.getInt8(0),
+                             I.b * sizeof(int64_t), llvm::MaybeAlign(8));
+        setReg(I.a, builder.CreatePtrToInt(array, i64));
+        break;
+      }
+      case OP_Jmp:
+        builder.CreateBr(mBlocks[I.imm]);
+        break;
+      case OP_Jz:
+      case OP_Jnz: {
+        llvm::Value *zero = builder.CreateICmpEQ(reg(I.a), builder.getInt64(0));
+        llvm::BasicBlock *target = mBlocks[I.imm];
+        llvm::BasicBlock *next = mBlocks[pc + 1];
+        if (I.op == OP_Jz)
+          builder.CreateCondBr(zero, target, next);
+        else
+          builder.CreateCondBr(zero, next, target);
+        break;
+      }
+      case OP_JEQ:
+      case OP_JNE:
+      case OP_JLT:
+      case OP_JGT:
+      case OP_JLE:
+      case OP_JGE:
+        builder.CreateCondBr(compare(I.op, reg(I.a), reg(I.b)), mBlocks[I.imm],
+                             mBlocks[pc + 1]);
+        break;
+      case OP_Call:
+      case OP_TailCall: {
+        // A tail call to the function itself becomes a jump to its start.
+        if (I.op == OP_TailCall && I.b == index && !func.pure) {
+          std::vector<llvm::Value *> args;
+          for (int64_t i = 0; i < I.imm; i++)
+            args.push_back(reg(I.c + i));
+          for (int64_t i = 0; i < I.imm; i++)
+            setReg(i, args[i]);
+          builder.CreateBr(mBlocks[0]);
+          break;
+        }
+        for (int64_t i = 0; i < I.imm; i++)
+          builder.CreateStore(reg(I.c + i),
+                              builder.CreateGEP(i64, argsBuf,
+                                                builder.getInt64(i)));
+        llvm::Value *result = callRuntime(mRuntime.call, i64,
+                                          {vm, i64Const(I.b), argsBuf});
+        if (I.op == OP_Call)
+          setReg(I.a, result);
+        else
+          emitReturn(func, vm, result, arraysSlot, ownSlot);
+        break;
+      }
+      case OP_Input:
+        setReg(I.a, callRuntime(mRuntime.input, i64, {envConst()}));
+        break;
+      case OP_Output:
+        callRuntime(mRuntime.output, builder.getVoidTy(),
+                    {envConst(), reg(I.b)});
+        break;
+      case OP_Malloc:
+        setReg(I.a, callRuntime(mRuntime.allocate, i64,
+                                {envConst(), reg(I.b)}));
+        break;
+      case OP_Free:
+        callRuntime(mRuntime.release, builder.getVoidTy(),
+                    {envConst(), reg(I.b)});
+        break;
+      case OP_Ret:
+        emitReturn(func, vm, reg(I.a), arraysSlot, ownSlot);
+        break;
+      case OP_RetImm:
+        emitReturn(func, vm, builder.getInt64(I.imm), arraysSlot, ownSlot);
+        break;
+      }
+    }
+    if (!builder.GetInsertBlock()->getTerminator())
+      builder.CreateRet(builder.getInt64(0));
+    // Blocks after the last return are never entered.
+    for (size_t pc = 0; pc < mBlocks.size(); pc++)
+      if (mBlocks[pc] && !mBlocks[pc]->getTerminator()) {
+        builder.SetInsertPoint(mBlocks[pc]);
+        builder.CreateUnreachable();
+      }
+    mContext = NULL;
+    mBuilder = NULL;
+  }
+
+  static bool isJump(Opcode op) { return op >= OP_Jmp && op <= OP_JGE; }
+  static bool isExit(Opcode op) {
+    return op == OP_TailCall || op == OP_Ret || op == OP_RetImm;
+  }
+
+  llvm::Value *reg(unsigned r) {
+    return mBuilder->CreateLoad(mBuilder->getInt64Ty(), mRegs[r]);
+  }
+  void setReg(unsigned r, llvm::Value *val) {
+    mBuilder->CreateStore(val, mRegs[r]);
+  }
+  llvm::Value *i64Const(int64_t val) { return mBuilder->getInt64(val); }
+  llvm::Value *envConst() {
+    return mBuilder->CreateIntToPtr(
+        i64Const(reinterpret_cast<int64_t>(mRuntime.env)),
+        mBuilder->getInt8PtrTy());
+  }
+  llvm::Value *address(llvm::Value *val) {
+    return mBuilder->CreateIntToPtr(val,
+                                    mBuilder->getInt64Ty()->getPointerTo());
+  }
+  llvm::Value *byteAddress(llvm::Value *val) {
+    return mBuilder->CreateIntToPtr(val, mBuilder->getInt8PtrTy());
+  }
+
+  llvm::Value *compare(Opcode op, llvm::Value *left, llvm::Value *right) {
+    switch (op) {
+    case OP_EQ:
+    case OP_JEQ:
+      return mBuilder->CreateICmpEQ(left, right);
+    case OP_NE:
+    case OP_JNE:
+      return mBuilder->CreateICmpNE(left, right);
+    case OP_LT:
+    case OP_JLT:
+      return mBuilder->CreateICmpSLT(left, right);
+    case OP_GT:
+    case OP_JGT:
+      return mBuilder->CreateICmpSGT(left, right);
+    case OP_LE:
+    case OP_JLE:
+      return mBuilder->CreateICmpSLE(left, right);
+    default:
+      return mBuilder->CreateICmpSGE(left, right);
+    }
+  }
+
+  // Call the runtime function at `target`, whose parameters all have the
+  // types of `args`.
+  template <typename Target>
+  llvm::Value *callRuntime(Target target, llvm::Type *result,
+                           llvm::ArrayRef<llvm::Value *> args) {
+    std::vector<llvm::Type *> params;
+    for (size_t i = 0; i < args.size(); i++)
+      params.push_back(args[i]->getType());
+    llvm::FunctionType *type = llvm::FunctionType::get(result, params, false);
+    llvm::Value *callee = mBuilder->CreateIntToPtr(
+        i64Const(reinterpret_cast<int64_t>(target)), type->getPointerTo());
+    return mBuilder->CreateCall(type, callee, args);
+  }
+
+  // Return `val`, releasing the arrays if this call allocated them.
+  void emitReturn(const BytecodeFunction &func, llvm::Value *vm,
+                  llvm::Value *val, llvm::Value *arraysSlot,
+                  llvm::Value *ownSlot) {
+    llvm::IRBuilder<> &builder = *mBuilder;
+    if (func.numArrayWords) {
+      llvm::Function *function = builder.GetInsertBlock()->getParent();
+      llvm::BasicBlock *release =
+          llvm::BasicBlock::Create(*mContext, "", function);
+      llvm::BasicBlock *done =
+          llvm::BasicBlock::Create(*mContext, "", function);
+      builder.CreateCondBr(builder.CreateLoad(builder.getInt1Ty(), ownSlot),
+                           release, done);
+      builder.SetInsertPoint(release);
+      callRuntime(mRuntime.releaseArrays, builder.getVoidTy(),
+                  {vm, builder.CreateLoad(builder.getInt64Ty()->getPointerTo(),
+                                          arraysSlot)});
+      builder.CreateBr(done);
+      builder.SetInsertPoint(done);
+    }
+    builder.CreateRet(val);
+  }
+
+  void optimize(llvm::Module &module) {
+    llvm::PassManagerBuilder options;
+    options.OptLevel = 2;
+    llvm::legacy::FunctionPassManager functionPasses(&module);
+    llvm::legacy::PassManager modulePasses;
+    options.populateFunctionPassManager(functionPasses);
+    options.populateModulePassManager(modulePasses);
+    functionPasses.doInitialization();
+    for (llvm::Module::iterator it = module.begin(), ie = module.end();
+         it != ie; ++it)
+      functionPasses.run(*it);
+    functionPasses.doFinalization();
+    modulePasses.run(module);
+  }
+};
@@ -0,0 +1,162 @@
+//==--- Layout.h - Frame layout pre-pass for the AST interpreter ----------===//
+//===----------------------------------------------------------------------===//
+#include "clang/AST/Decl.h"
+#include "llvm/ADT/DenseMap.h"
+
+using namespace clang;
+
+#include "Types.h"
+#include "ConstantFold.h"
+
+// What a StackFrame of one function needs to hold.
+struct FunctionLayout {
+  // Number of expressions in the body; each one owns a value slot.
+  unsigned numExprs;
+  // Number of variables; parameters come first, in declaration order.
+  unsigned numVars;
+  // Number of int64_t words all local arrays take together; each array
+  // starts at a word.
+  unsigned numArrayWords;
+  // Number of int64_t-sized slots a frame of this function occupies: a value
+  // per variable, a value and an address per expression, and the words of
+  // its arrays.
+  unsigned frameSize;
+};
+
+// Where a variable lives: a slot of the current frame or of the global
+// segment.
+struct VarSlot {
+  bool global;
+  unsigned index;
+  // For a local array, the word its elements start at in the frame.
+  unsigned storage;
+};
+
+// Layout numbers every expression of a function body densely from 0, so a
+// StackFrame can keep intermediate results in a flat array instead of a map.
+// Variables are numbered the same way, per function for locals and across
+// the translation unit for globals. It is computed once per translation unit
+// before anything executes.
+//
+// Constant expressions take no frame slot. Their slot is CONST_SLOT plus an
+// index into a table of folded values, and their operands get no slot at all.
+class Layout {
+  llvm::DenseMap<const Stmt *, unsigned> mExprSlots;
+  std::vector<int64_t> mConstants;
+  llvm::DenseMap<const Decl *, VarSlot> mVarSlots;
+  llvm::DenseMap<const FunctionDecl *, FunctionLayout> mFunctions;
+  // Global initializers are evaluated in a frame of their own.
+  FunctionLayout mGlobals;
+  unsigned mNumGlobalVars;
+
+public:
+  static const unsigned CONST_SLOT = 1u << 31;
+
+  Layout() : mNumGlobalVars(0) {
+    mGlobals.numExprs = 0;
+    mGlobals.numVars = 0;
+    mGlobals.numArrayWords = 0;
+    mGlobals.frameSize = 0;
+  }
+
+  void build(TranslationUnitDecl *unit, const ConstantFolder &folder) {
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      if (FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i)) {
+        if (fdecl->isThisDeclarationADefinition()) {
+          FunctionLayout layout;
+          layout.numExprs = 0;
+          layout.numVars = 0;
+          layout.numArrayWords = 0;
+          for (unsigned p = 0; p < fdecl->getNumParams(); p++)
+            addVar(fdecl->getParamDecl(p), false, layout.numVars);
+          number(fdecl->getBody(), folder, layout);
+          layout.frameSize =
+              layout.numVars + 2 * layout.numExprs + layout.numArrayWords;
+          mFunctions[fdecl] = layout;
+        }
+      } else if (VarDecl *vardecl = dyn_cast<VarDecl>(*i)) {
+        addVar(vardecl, true, mNumGlobalVars);
+        if (vardecl->hasInit())
+          number(vardecl->getInit(), folder, mGlobals);
+      }
+    }
+    mGlobals.frameSize = mGlobals.numVars + 2 * mGlobals.numExprs;
+  }
+
+  unsigned getExprSlot(const Stmt *stmt) const {
+    llvm::DenseMap<const Stmt *, unsigned>::const_iterator it =
+        mExprSlots.find(stmt);
+    if (it == mExprSlots.end()) {
+      llvm::errs() << "Statement not found\n";
+      stmt->dump();
+      assert(false);
+    }
+    return it->second;
+  }
+  // The value of a constant slot.
+  int64_t getConstant(unsigned slot) const {
+    return mConstants[slot & ~CONST_SLOT];
+  }
+
+  // The layout of the function called through `callee`, which may be a
+  // forward declaration.
+  const FunctionLayout &getFunction(FunctionDecl *callee) const {
+    llvm::DenseMap<const FunctionDecl *, FunctionLayout>::const_iterator it =
+        mFunctions.find(callee->getDefinition());
+    assert(it != mFunctions.end());
+    return it->second;
+  }
+  const FunctionLayout &getGlobals() const { return mGlobals; }
+  unsigned getNumGlobalVars() const { return mNumGlobalVars; }
+
+  // The slot of a variable, or NULL if `decl` is not one we laid out.
+  const VarSlot *findVar(const Decl *decl) const {
+    llvm::DenseMap<const Decl *, VarSlot>::const_iterator it =
+        mVarSlots.find(decl);
+    if (it == mVarSlots.end())
+      return NULL;
+    return &it->second;
+  }
+
+private:
+  VarSlot &addVar(const Decl *decl, bool global, unsigned &count) {
+    VarSlot &slot = mVarSlots[decl];
+    slot.global = global;
+    slot.index = count++;
+    slot.storage = 0;
+    return slot;
+  }
+
+  void number(Stmt *stmt, const ConstantFolder &folder,
+              FunctionLayout &layout) {
+    if (!stmt)
+      return;
+    if (Expr *expr = dyn_cast<Expr>(stmt)) {
+      if (const int64_t *val = folder.lookup(expr)) {
+        mExprSlots[stmt] = CONST_SLOT | mConstants.size();
+        mConstants.push_back(*val);
+        return;
+      }
+      mExprSlots[stmt] = layout.numExprs++;
+    }
+    else if (DeclStmt *declstmt = dyn_cast<DeclStmt>(stmt)) {
+      for (DeclStmt::decl_iterator it = declstmt->decl_begin(),
+                                   ie = declstmt->decl_end();
+           it != ie; ++it)
+        if (VarDecl *vardecl = dyn_cast<VarDecl>(*it)) {
+          VarSlot &slot = addVar(vardecl, false, layout.numVars);
+          if (isa<ConstantArrayType>(vardecl->getType().getTypePtr())) {
+            slot.storage = layout.numArrayWords;
+            layout.numArrayWords +=
+                (getTypeWidth(vardecl->getType()) + sizeof(int64_t) - 1) /
+                sizeof(int64_t);
+          }
+        }
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      number(*it, folder, layout);
+  }
+};
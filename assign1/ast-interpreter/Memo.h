@@ -0,0 +1,175 @@
+//==--- Memo.h - Memoization of pure interpreted functions ----------------===//
+//===----------------------------------------------------------------------===//
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Expr.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/ADT/DenseSet.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+// The most parameters a memoized function may take.
+static const unsigned MEMO_MAX_ARGS = 4;
+
+// PurityAnalysis finds the functions whose result depends only on their
+// arguments and which have no effect besides returning it: they call no
+// built-in and no impure function, touch no global variable, and neither
+// read nor write memory through a pointer. Calls to them can be answered
+// from a MemoTable.
+class PurityAnalysis {
+  llvm::DenseSet<const FunctionDecl *> mPure;
+
+public:
+  void run(TranslationUnitDecl *unit) {
+    // Start from the functions that are pure on their own, then drop those
+    // calling a function that is not, until nothing changes.
+    llvm::DenseMap<const FunctionDecl *, std::vector<const FunctionDecl *>>
+        callees;
+    for (TranslationUnitDecl::decl_iterator i = unit->decls_begin(),
+                                            e = unit->decls_end();
+         i != e; ++i) {
+      FunctionDecl *fdecl = dyn_cast<FunctionDecl>(*i);
+      if (!fdecl || !fdecl->isThisDeclarationADefinition())
+        continue;
+      std::vector<const FunctionDecl *> &calls = callees[fdecl];
+      if (isCandidate(fdecl) && isLocallyPure(fdecl->getBody(), calls))
+        mPure.insert(fdecl);
+    }
+    bool changed = true;
+    while (changed) {
+      changed = false;
+      for (llvm::DenseMap<const FunctionDecl *,
+                          std::vector<const FunctionDecl *>>::iterator
+               it = callees.begin(),
+               ie = callees.end();
+           it != ie; ++it) {
+        if (!mPure.count(it->first))
+          continue;
+        for (size_t c = 0; c < it->second.size(); c++) {
+          if (!mPure.count(it->second[c])) {
+            mPure.erase(it->first);
+            changed = true;
+            break;
+          }
+        }
+      }
+    }
+  }
+
+  // Whether calls to `callee`, which may be a forward declaration, can be
+  // memoized.
+  bool isPure(FunctionDecl *callee) const {
+    return mPure.count(callee->getDefinition());
+  }
+
+private:
+  // Functions returning a value from a few integer or pointer arguments.
+  static bool isCandidate(FunctionDecl *fdecl) {
+    if (fdecl->getReturnType()->isVoidType() ||
+        fdecl->getNumParams() > MEMO_MAX_ARGS)
+      return false;
+    for (unsigned i = 0; i < fdecl->getNumParams(); i++) {
+      QualType type = fdecl->getParamDecl(i)->getType();
+      if (!type->isIntegerType() && !type->isPointerType())
+        return false;
+    }
+    return true;
+  }
+
+  // Whether `stmt` is pure apart from its calls, which are collected in
+  // `calls`.
+  static bool isLocallyPure(Stmt *stmt,
+                            std::vector<const FunctionDecl *> &calls) {
+    if (!stmt)
+      return true;
+    if (CallExpr *call = dyn_cast<CallExpr>(stmt)) {
+      FunctionDecl *callee = call->getDirectCallee();
+      // Built-ins have no definition.
+      if (!callee || !callee->getDefinition())
+        return false;
+      calls.push_back(callee->getDefinition());
+    } else if (DeclRefExpr *declref = dyn_cast<DeclRefExpr>(stmt)) {
+      if (VarDecl *vardecl = dyn_cast<VarDecl>(declref->getFoundDecl()))
+        if (vardecl->hasGlobalStorage())
+          return false;
+    } else if (isa<ArraySubscriptExpr>(stmt)) {
+      return false;
+    } else if (UnaryOperator *uop = dyn_cast<UnaryOperator>(stmt)) {
+      if (uop->getOpcode() == UO_Deref)
+        return false;
+    }
+    for (Stmt::child_iterator it = stmt->child_begin(), ie = stmt->child_end();
+         it != ie; ++it)
+      if (!isLocallyPure(*it, calls))
+        return false;
+    return true;
+  }
+};
+
+// MemoTable maps a pure function and its arguments to its result. It has a
+// fixed number of entries, and a new result replaces whatever was stored
+// under the same hash.
+class MemoTable {
+  struct Entry {
+    const FunctionDecl *function;
+    int64_t args[MEMO_MAX_ARGS];
+    int64_t result;
+  };
+
+  static const size_t NUM_ENTRIES = 1 << 16;
+
+  // Allocated on the first store.
+  std::vector<Entry> mEntries;
+  uint64_t mHits;
+  uint64_t mMisses;
+  uint64_t mEvictions;
+
+public:
+  MemoTable() : mHits(0), mMisses(0), mEvictions(0) {}
+
+  // Look up `function` applied to `args`, which holds MEMO_MAX_ARGS values
+  // with the unused ones zero.
+  bool lookup(const FunctionDecl *function, const int64_t *args,
+              int64_t &result) {
+    if (!mEntries.empty()) {
+      const Entry &entry = mEntries[hash(function, args)];
+      if (entry.function == function &&
+          memcmp(entry.args, args, sizeof(entry.args)) == 0) {
+        mHits++;
+        result = entry.result;
+        return true;
+      }
+    }
+    mMisses++;
+    return false;
+  }
+
+  void store(const FunctionDecl *function, const int64_t *args,
+             int64_t result) {
+    if (mEntries.empty()) {
+      Entry empty = {NULL, {0}, 0};
+      mEntries.assign(NUM_ENTRIES, empty);
+    }
+    Entry &entry = mEntries[hash(function, args)];
+    if (entry.function)
+      mEvictions++;
+    entry.function = function;
+    memcpy(entry.args, args, sizeof(entry.args));
+    entry.result = result;
+  }
+
+  void printStats(llvm::raw_ostream &os) const {
+    os << "memo: hits " << mHits << " misses " << mMisses << " evictions "
+       << mEvictions << "\n";
+  }
+
+private:
+  static size_t hash(const FunctionDecl *function, const int64_t *args) {
+    uint64_t h = reinterpret_cast<uintptr_t>(function);
+    for (unsigned i = 0; i < MEMO_MAX_ARGS; i++)
+      h = (h ^ (uint64_t)args[i]) * 0x9e3779b97f4a7c15ULL;
+    return (h >> 32) & (NUM_ENTRIES - 1);
+  }
+};
@@ -0,0 +1,171 @@
+//==--- Profiler.h - Statement counts and call times of the AST walker ----===//
+//===----------------------------------------------------------------------===//
+#include <stdint.h>
+
+#include <algorithm>
+#include <chrono>
+#include <memory>
+#include <string>
+#include <vector>
+
+#include "clang/AST/Decl.h"
+#include "clang/AST/Stmt.h"
+#include "clang/Basic/SourceManager.h"
+#include "llvm/ADT/DenseMap.h"
+#include "llvm/Support/Format.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+// Profiler counts how often each statement runs and times every call of an
+// interpreted function along the interpreter's own call stack. Time spent
+// in a function itself is kept per distinct call stack, which is what
+// flame graph tools take as folded stacks.
+class Profiler {
+  typedef std::chrono::steady_clock Clock;
+
+  // One node per distinct call stack, below the node of its caller. A
+  // function calling itself stays in its node, so deep recursion does not
+  // make deep stacks.
+  struct Node {
+    const FunctionDecl *function;
+    Node *parent;
+    llvm::DenseMap<const FunctionDecl *, Node *> children;
+    uint64_t selfNs;
+  };
+  struct FunctionStats {
+    uint64_t calls;
+    uint64_t inclusiveNs;
+    uint64_t exclusiveNs;
+    // Calls currently on the stack; only the outermost one adds to the
+    // inclusive time of a recursive function.
+    unsigned active;
+  };
+  struct Activation {
+    Node *node;
+    Clock::time_point start;
+    uint64_t calleeNs;
+  };
+
+  llvm::DenseMap<const Stmt *, uint64_t> mStmtCounts;
+  llvm::DenseMap<const FunctionDecl *, FunctionStats> mFunctions;
+  std::vector<std::unique_ptr<Node>> mNodes;
+  Node mRoot;
+  std::vector<Activation> mStack;
+
+public:
+  Profiler() {
+    mRoot.function = NULL;
+    mRoot.parent = NULL;
+    mRoot.selfNs = 0;
+  }
+
+  void count(const Stmt *stmt) { mStmtCounts[stmt]++; }
+
+  void enter(const FunctionDecl *function) {
+    Node *caller = mStack.empty() ? &mRoot : mStack.back().node;
+    Node *node = caller;
+    if (caller->function != function) {
+      Node *&child = caller->children[function];
+      if (!child) {
+        mNodes.push_back(std::unique_ptr<Node>(new Node()));
+        child = mNodes.back().get();
+        child->function = function;
+        child->parent = caller;
+        child->selfNs = 0;
+      }
+      node = child;
+    }
+    FunctionStats &stats = mFunctions[function];
+    stats.calls++;
+    stats.active++;
+    Activation activation = {node, Clock::now(), 0};
+    mStack.push_back(activation);
+  }
+
+  void exit() {
+    Activation activation = mStack.back();
+    mStack.pop_back();
+    uint64_t elapsed = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                           Clock::now() - activation.start)
+                           .count();
+    uint64_t self = elapsed - std::min(elapsed, activation.calleeNs);
+    activation.node->selfNs += self;
+    FunctionStats &stats = mFunctions[activation.node->function];
+    stats.exclusiveNs += self;
+    if (--stats.active == 0)
+      stats.inclusiveNs += elapsed;
+    if (!mStack.empty())
+      mStack.back().calleeNs += elapsed;
+  }
+
+  // Functions by exclusive time, then source lines by how many statements
+  // starting on them ran.
+  void writeReport(llvm::raw_ostream &os, const SourceManager &sm) const {
+    std::vector<std::pair<const FunctionDecl *, FunctionStats>> functions(
+        mFunctions.begin(), mFunctions.end());
+    std::sort(functions.begin(), functions.end(),
+              [](const std::pair<const FunctionDecl *, FunctionStats> &a,
+                 const std::pair<const FunctionDecl *, FunctionStats> &b) {
+                return a.second.exclusiveNs > b.second.exclusiveNs;
+              });
+    os << "function                        calls   inclusive-ms   "
+          "exclusive-ms\n";
+    for (size_t i = 0; i < functions.size(); i++) {
+      const FunctionStats &stats = functions[i].second;
+      os << llvm::format("%-24s %12llu %14.3f %14.3f\n",
+                         functions[i].first->getNameAsString().c_str(),
+                         (unsigned long long)stats.calls,
+                         stats.inclusiveNs / 1e6, stats.exclusiveNs / 1e6);
+    }
+
+    llvm::DenseMap<unsigned, uint64_t> lineCounts;
+    for (llvm::DenseMap<const Stmt *, uint64_t>::const_iterator
+             it = mStmtCounts.begin(),
+             ie = mStmtCounts.end();
+         it != ie; ++it)
+      lineCounts[sm.getSpellingLineNumber(it->first->getBeginLoc())] +=
+          it->second;
+    std::vector<std::pair<unsigned, uint64_t>> lines(lineCounts.begin(),
+                                                     lineCounts.end());
+    std::sort(lines.begin(), lines.end(),
+              [](const std::pair<unsigned, uint64_t> &a,
+                 const std::pair<unsigned, uint64_t> &b) {
+                return a.second != b.second ? a.second > b.second
+                                            : a.first < b.first;
+              });
+    bool invalid = false;
+    llvm::StringRef source = sm.getBufferData(sm.getMainFileID(), &invalid);
+    llvm::SmallVector<llvm::StringRef, 64> text;
+    if (!invalid)
+      source.split(text, '\n');
+    os << "\n  line          count  source\n";
+    for (size_t i = 0; i < lines.size(); i++) {
+      unsigned line = lines[i].first;
+      std::string code;
+      if (line >= 1 && line <= text.size())
+        code = text[line - 1].trim().str();
+      os << llvm::format("%6u %14llu  %s\n", line,
+                         (unsigned long long)lines[i].second, code.c_str());
+    }
+  }
+
+  // One "main;caller;callee nanoseconds" line per call stack that spent
+  // time in its innermost function.
+  void writeFolded(llvm::raw_ostream &os) const {
+    for (size_t i = 0; i < mNodes.size(); i++) {
+      const Node *node = mNodes[i].get();
+      if (!node->selfNs)
+        continue;
+      std::vector<const Node *> path;
+      for (const Node *n = node; n != &mRoot; n = n->parent)
+        path.push_back(n);
+      for (size_t p = path.size(); p-- > 0;) {
+        os << path[p]->function->getName();
+        if (p)
+          os << ";";
+      }
+      os << " " << node->selfNs << "\n";
+    }
+  }
+};
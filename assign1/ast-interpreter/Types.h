@@ -0,0 +1,126 @@
+//==--- Types.h - Sizes and memory access of the interpreted types --------===//
+//===----------------------------------------------------------------------===//
+#include <stdint.h>
+#include <string.h>
+
+#include <algorithm>
+
+#include "clang/AST/Type.h"
+#include "llvm/Support/raw_ostream.h"
+
+using namespace clang;
+
+// How a scalar of some type is stored in memory. Characters take a single
+// byte; ints, pointers and every other scalar take a whole int64_t word.
+// Variables always take a word, holding the value a load of their kind
+// would give.
+enum MemKind { MK_Word, MK_Byte, MK_UByte };
+
+static MemKind getMemKind(QualType type) {
+  if (!type->isCharType())
+    return MK_Word;
+  return type->isUnsignedIntegerType() ? MK_UByte : MK_Byte;
+}
+
+template <MemKind Kind> static constexpr int64_t memWidth() {
+  return Kind == MK_Word ? sizeof(int64_t) : 1;
+}
+
+// `sizeof(type)`: a byte for characters, a word for other scalars, and the
+// size of all elements for arrays.
+static int64_t getTypeWidth(QualType type) {
+  if (const ConstantArrayType *array =
+          dyn_cast<ConstantArrayType>(type.getTypePtr()))
+    return array->getSize().getSExtValue() *
+           getTypeWidth(array->getElementType());
+  return getMemKind(type) == MK_Word ? sizeof(int64_t) : 1;
+}
+
+// How far adding 1 moves a pointer of `type`.
+static int64_t getPointeeWidth(QualType type) {
+  return getTypeWidth(type->getPointeeType());
+}
+
+// Whether `type` is a pointer stepping by words rather than bytes. Pointers
+// to anything wider than a word are not supported.
+static bool isWordPointer(QualType type) {
+  if (!type->isPointerType())
+    return false;
+  int64_t width = getPointeeWidth(type);
+  if (width > (int64_t)sizeof(int64_t)) {
+    llvm::errs() << "Unsupported pointer type\n";
+    type->dump();
+    assert(false);
+  }
+  return width == sizeof(int64_t);
+}
+
+// `val` converted to a scalar of kind `Kind`.
+template <MemKind Kind> static int64_t narrow(int64_t val) {
+  switch (Kind) {
+  case MK_Byte:
+    return (int8_t)val;
+  case MK_UByte:
+    return (uint8_t)val;
+  default:
+    return val;
+  }
+}
+static int64_t narrow(MemKind kind, int64_t val) {
+  switch (kind) {
+  case MK_Byte:
+    return narrow<MK_Byte>(val);
+  case MK_UByte:
+    return narrow<MK_UByte>(val);
+  default:
+    return val;
+  }
+}
+
+template <MemKind Kind> static int64_t loadMem(const void *addr) {
+  switch (Kind) {
+  case MK_Byte:
+    return *(const int8_t *)addr;
+  case MK_UByte:
+    return *(const uint8_t *)addr;
+  default:
+    return *(const int64_t *)addr;
+  }
+}
+template <MemKind Kind> static void storeMem(void *addr, int64_t val) {
+  if (Kind == MK_Word)
+    *(int64_t *)addr = val;
+  else
+    *(uint8_t *)addr = (uint8_t)val;
+}
+
+// Store `val` in `count` consecutive scalars of kind `Kind` from `addr`.
+template <MemKind Kind>
+static void fillMem(void *addr, int64_t val, uint64_t count) {
+  if (Kind != MK_Word || val == 0)
+    memset(addr, (uint8_t)val, count * memWidth<Kind>());
+  else
+    std::fill_n((int64_t *)addr, count, val);
+}
+
+// The sum of `count` consecutive scalars of kind `Kind` from `addr`,
+// wrapping around like the interpreted additions. The loop is simple
+// enough for the host compiler to vectorize.
+template <MemKind Kind>
+static int64_t sumMem(const void *addr, uint64_t count) {
+  uint64_t sum = 0;
+  switch (Kind) {
+  case MK_Byte:
+    for (uint64_t i = 0; i < count; i++)
+      sum += (uint64_t)(int64_t)((const int8_t *)addr)[i];
+    break;
+  case MK_UByte:
+    for (uint64_t i = 0; i < count; i++)
+      sum += ((const uint8_t *)addr)[i];
+    break;
+  default:
+    for (uint64_t i = 0; i < count; i++)
+      sum += (uint64_t)((const int64_t *)addr)[i];
+  }
+  return (int64_t)sum;
+}
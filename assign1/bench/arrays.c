@@ -0,0 +1,30 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Local arrays: n calls of a function declaring `int a[100]`. Frames keep
+// their arrays, so memory stays flat however many calls run. Counting the
+// calls in a global keeps them from being memoized.
+int calls;
+
+int touch(int x) {
+   int a[100];
+   calls = calls + 1;
+   a[0] = x;
+   a[99] = a[0] + x;
+   a[x - x / 100 * 100] = x * 3;
+   return a[99] + a[0];
+}
+
+int main() {
+   int n;
+   int i;
+   int s = 0;
+   n = GET();
+   for (i = 0; i < n; i = i + 1)
+      s = s + touch(i);
+   PRINT(s);
+   PRINT(calls);
+   return 0;
+}
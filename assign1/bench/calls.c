@@ -0,0 +1,27 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// 200100 interpreted calls: 100000 leaf calls and 100 recursions of depth
+// 1000.
+int add(int a, int b) {
+   return a + b;
+}
+
+int depth(int n) {
+   if (n == 0)
+      return 0;
+   return 1 + depth(n - 1);
+}
+
+int main() {
+   int i;
+   int s = 0;
+   for (i = 0; i < 100000; i = i + 1)
+      s = add(s, i);
+   for (i = 0; i < 100; i = i + 1)
+      s = s + depth(1000);
+   PRINT(s);
+   return 0;
+}
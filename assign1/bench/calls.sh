@@ -0,0 +1,14 @@
+#!/bin/bash
+# Reports interpreted calls per second on calls.c for the tree walker and the
+# bytecode VM. Memoization is off so that every call is really made.
+#   usage: calls.sh [path/to/ast-interpreter]
+BIN=${1:-./ast-interpreter}
+DIR=$(dirname "$0")
+SRC=$(cat "$DIR/calls.c")
+CALLS=200100
+TIMEFORMAT=%R
+for mode in --tree-walk ""; do
+   secs=$( { time "$BIN" $mode --no-memo "$SRC" 2>/dev/null >/dev/null; } 2>&1 )
+   awk -v m="${mode:---vm}" -v c=$CALLS -v s="$secs" \
+      'BEGIN { printf "%-12s %8.3fs %12.0f calls/s\n", m, s, c / s }'
+done
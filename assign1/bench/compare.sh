@@ -0,0 +1,64 @@
+#!/bin/bash
+# Compiles each program in the given directories natively with the runtime
+# in native/runtime.c, runs it and the interpreter on the same GET input,
+# <name>.in, and checks that both print the same. Reports the wall time of
+# the native run and of the tree walker and the bytecode VM, and how many
+# times slower each engine is. A table goes to stdout and one JSON object
+# per engine to the results file. Fails if any output differs.
+#   usage: compare.sh [path/to/ast-interpreter] [results.jsonl] [dir...]
+BIN=${1:-./ast-interpreter}
+OUT=${2:-compare.jsonl}
+DIR=$(dirname "$0")
+shift $(($# < 2 ? $# : 2))
+DIRS=("$@")
+[ ${#DIRS[@]} -gt 0 ] || DIRS=("$DIR" "$DIR/../tests")
+# Ints are words in the interpreter and additions wrap around.
+CFLAGS="-O2 -w -fwrapv -Dint=long"
+CC=${CC:-cc}
+TMP=$(mktemp -d)
+trap 'rm -rf "$TMP"' EXIT
+$CC -O2 -c "$DIR/native/runtime.c" -o "$TMP/runtime.o" || exit 1
+failed=0
+: > "$OUT"
+printf "%-10s %-10s %-4s %10s %10s %10s\n" \
+   program engine same native-s engine-s slowdown
+for dir in "${DIRS[@]}"; do
+   for src in "$dir"/*.c; do
+      name=$(basename "$src" .c)
+      input="$dir/$name.in"
+      [ -f "$input" ] || input=/dev/null
+      if ! $CC $CFLAGS "$src" "$TMP/runtime.o" -o "$TMP/$name"; then
+         echo "$name: native build failed"
+         failed=1
+         continue
+      fi
+      start=$(date +%s%N)
+      "$TMP/$name" < "$input" > "$TMP/native.out"
+      end=$(date +%s%N)
+      native=$((end - start))
+      for engine in tree-walk vm; do
+         flags=
+         [ $engine = tree-walk ] && flags=--tree-walk
+         start=$(date +%s%N)
+         "$BIN" $flags --stdout --input "$input" "$(cat "$src")" \
+            > "$TMP/engine.out" 2>/dev/null
+         end=$(date +%s%N)
+         same=yes
+         cmp -s "$TMP/native.out" "$TMP/engine.out" || same=no
+         [ $same = yes ] || failed=1
+         awk -v p="$name" -v e=$engine -v m=$same -v n=$native \
+             -v t=$((end - start)) -v out="$OUT" 'BEGIN {
+            if (n < 1)
+               n = 1
+            printf "%-10s %-10s %-4s %10.3f %10.3f %10.1f\n", p, e, m,
+               n / 1e9, t / 1e9, t / n
+            printf "{\"program\": \"%s\", \"engine\": \"%s\", " \
+               "\"same_output\": %s, \"native_s\": %.6f, " \
+               "\"engine_s\": %.6f, \"slowdown\": %.2f}\n", p, e,
+               m == "yes" ? "true" : "false", n / 1e9, t / 1e9,
+               t / n >> out
+         }'
+      done
+   done
+done
+exit $failed
@@ -0,0 +1,30 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Deep recursion: `rounds` recursions `depth` calls deep, neither of them
+// tail calls. Counting the calls in a global keeps them from being
+// memoized.
+int calls;
+
+int down(int n) {
+   calls = calls + 1;
+   if (n == 0)
+      return 0;
+   return down(n - 1) + 1;
+}
+
+int main() {
+   int depth;
+   int rounds;
+   int i;
+   int s = 0;
+   depth = GET();
+   rounds = GET();
+   for (i = 0; i < rounds; i = i + 1)
+      s = s + down(depth);
+   PRINT(s);
+   PRINT(calls);
+   return 0;
+}
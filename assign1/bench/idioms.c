@@ -0,0 +1,72 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Loops that are one bulk operation: an array of n ints is filled and
+// summed `rounds` times, then copied to a second array and summed back down
+// `rounds` times. Copies through a pointer into the same array overlap and
+// must move the elements one by one, smearing when they run upwards. A char
+// array is copied onto itself the same way. Prints a checksum after each
+// stage.
+int main() {
+   int n;
+   int rounds;
+   int *a;
+   int *b;
+   char *c;
+   int *p;
+   char *q;
+   int i;
+   int r;
+   int s;
+   n = GET();
+   rounds = GET();
+   a = (int *)MALLOC(n * sizeof(int));
+   b = (int *)MALLOC(n * sizeof(int));
+   c = (char *)MALLOC(n);
+   s = 0;
+   for (r = 0; r < rounds; r = r + 1) {
+      for (i = 0; i < n; i = i + 1)
+         a[i] = r;
+      for (i = 0; i < n; i = i + 1)
+         s = s + a[i];
+   }
+   PRINT(s);
+   for (i = 0; i < n; i = i + 1)
+      a[i] = i;
+   for (r = 0; r < rounds; r = r + 1) {
+      for (i = 0; i < n; i = i + 1)
+         b[i] = a[i];
+      for (i = n - 1; i >= 0; i = i - 1)
+         s = b[i] + s;
+   }
+   PRINT(s);
+   p = a + 1;
+   for (i = 0; i < 9; i = i + 1)
+      p[i] = a[i];
+   for (i = n - 2; i >= 10; i = i - 1)
+      p[i] = a[i];
+   p = b + 1;
+   for (i = 0; i < n - 1; i = i + 1)
+      b[i] = p[i];
+   s = 0;
+   for (i = 0; i < n; i = i + 1)
+      s = s + a[i] * (i + 1) - b[i];
+   PRINT(s);
+   for (i = 0; i < n; i = i + 1)
+      c[i] = i * 3;
+   q = c + 100;
+   for (i = 0; i < n - 100; i = i + 1)
+      q[i] = c[i];
+   for (i = 0; i < 50; i = i + 1)
+      c[i] = 200;
+   s = 0;
+   for (i = 0; i < n; i = i + 1)
+      s = s + c[i];
+   PRINT(s);
+   FREE(a);
+   FREE(b);
+   FREE(c);
+   return 0;
+}
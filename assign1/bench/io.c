@@ -0,0 +1,21 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Input and output: reads n, then n values, printing each one and finally
+// their sum. Every value is a GET and a PRINT.
+int main() {
+   int n;
+   int i;
+   int v;
+   int s = 0;
+   n = GET();
+   for (i = 0; i < n; i = i + 1) {
+      v = GET();
+      PRINT(v);
+      s = s + v;
+   }
+   PRINT(s);
+   return 0;
+}
@@ -0,0 +1,52 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Pointer chasing: n list nodes, each a next pointer and a pointer to its
+// value, are linked in a scattered order into a ring that is walked
+// `rounds` times. Node k is followed by node k + step wrapping around, so
+// with step and n sharing no divisor the ring takes in every node.
+int main() {
+   int n;
+   int step;
+   int rounds;
+   int i;
+   int k = 0;
+   int s = 0;
+   int *values;
+   int **nodes;
+   int **node;
+   n = GET();
+   step = GET();
+   rounds = GET();
+   values = (int *)MALLOC(n * sizeof(int));
+   nodes = (int **)MALLOC(n * sizeof(int *));
+   for (i = 0; i < n; i = i + 1) {
+      values[i] = i;
+      nodes[i] = (int *)MALLOC(2 * sizeof(int *));
+   }
+   for (i = 0; i < n; i = i + 1) {
+      node = (int **)nodes[k];
+      k = k + step;
+      if (k >= n)
+         k = k - n;
+      node[0] = nodes[k];
+      node[1] = values + k;
+   }
+
+   node = (int **)nodes[0];
+   for (i = 0; i < n * rounds; i = i + 1) {
+      s = s + *node[1];
+      if (s > 1000000)
+         s = s - 1000000;
+      node = (int **)node[0];
+   }
+   PRINT(s);
+
+   for (i = 0; i < n; i = i + 1)
+      FREE(nodes[i]);
+   FREE(nodes);
+   FREE(values);
+   return 0;
+}
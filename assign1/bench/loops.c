@@ -0,0 +1,29 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Long counted loops: a triangular double loop of n * (n - 1) / 2 steps and
+// a single loop of n * n steps, n read from input.
+int main() {
+   int n;
+   int i;
+   int j;
+   int s = 0;
+   n = GET();
+   for (i = 0; i < n; i = i + 1) {
+      for (j = 0; j < i; j = j + 1) {
+         s = s + j;
+         if (s > 1000000)
+            s = s - 1000000;
+      }
+   }
+   PRINT(s);
+   for (i = 0; i < n * n; i = i + 1) {
+      s = s + i / n;
+      if (s > 1000000)
+         s = s - 1000000;
+   }
+   PRINT(s);
+   return 0;
+}
@@ -0,0 +1,43 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Matrix multiplication: c = a * b for n * n matrices stored by rows, n
+// read from input. Prints the trace of c.
+int main() {
+   int n;
+   int i;
+   int j;
+   int k;
+   int s;
+   int *a;
+   int *b;
+   int *c;
+   n = GET();
+   a = (int *)MALLOC(n * n * sizeof(int));
+   b = (int *)MALLOC(n * n * sizeof(int));
+   c = (int *)MALLOC(n * n * sizeof(int));
+   for (i = 0; i < n; i = i + 1) {
+      for (j = 0; j < n; j = j + 1) {
+         a[i * n + j] = i - j + 1;
+         b[i * n + j] = i + j;
+      }
+   }
+   for (i = 0; i < n; i = i + 1) {
+      for (j = 0; j < n; j = j + 1) {
+         s = 0;
+         for (k = 0; k < n; k = k + 1)
+            s = s + a[i * n + k] * b[k * n + j];
+         c[i * n + j] = s;
+      }
+   }
+   s = 0;
+   for (i = 0; i < n; i = i + 1)
+      s = s + c[i * n + i];
+   PRINT(s);
+   FREE(a);
+   FREE(b);
+   FREE(c);
+   return 0;
+}
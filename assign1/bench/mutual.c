@@ -0,0 +1,37 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Mutual recursion: Hofstadter's female and male sequences,
+//   F(0) = 1, F(n) = n - M(F(n - 1)); M(0) = 0, M(n) = n - F(M(n - 1)),
+// computed naively for 0..n. Counting the calls in a global keeps them from
+// being memoized.
+int calls;
+int male(int n);
+
+int female(int n) {
+   calls = calls + 1;
+   if (n == 0)
+      return 1;
+   return n - male(female(n - 1));
+}
+
+int male(int n) {
+   calls = calls + 1;
+   if (n == 0)
+      return 0;
+   return n - female(male(n - 1));
+}
+
+int main() {
+   int n;
+   int i;
+   int s = 0;
+   n = GET();
+   for (i = 0; i <= n; i = i + 1)
+      s = s + female(i) - male(i);
+   PRINT(s);
+   PRINT(calls);
+   return 0;
+}
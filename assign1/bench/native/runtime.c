@@ -0,0 +1,19 @@
+// The built-in functions of the interpreter for programs compiled natively
+// by compare.sh. The programs are built with int defined as long, so that
+// values are 8-byte words as in the interpreter. PRINT writes to stdout like
+// `--stdout`, and GET reads like it without a prompt.
+#include <stdio.h>
+#include <stdlib.h>
+
+long GET() {
+   long val;
+   if (scanf("%ld", &val) != 1)
+      return 0;
+   return val;
+}
+
+void *MALLOC(long size) { return malloc(size); }
+
+void FREE(void *ptr) { free(ptr); }
+
+void PRINT(long val) { printf("%ld", val); }
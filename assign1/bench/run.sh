@@ -0,0 +1,42 @@
+#!/bin/bash
+# Runs each program in this directory with its fixed GET input, <name>.in,
+# on the tree walker and on the bytecode VM, and reports wall time, AST
+# nodes evaluated per second and peak RSS. Nodes are counted by the tree
+# walker; the VM's rate is for the same work. A table goes to stdout and
+# one JSON object per run to the results file.
+#   usage: run.sh [path/to/ast-interpreter] [results.jsonl]
+BIN=${1:-./ast-interpreter}
+OUT=${2:-bench.jsonl}
+DIR=$(dirname "$0")
+failed=0
+: > "$OUT"
+printf "%-10s %-10s %4s %10s %12s %14s %12s\n" \
+   bench engine exit wall-s nodes nodes/s peak-rss-kb
+for src in "$DIR"/*.c; do
+   name=$(basename "$src" .c)
+   input="$DIR/$name.in"
+   [ -f "$input" ] || input=/dev/null
+   nodes=0
+   for engine in tree-walk vm; do
+      flags=
+      [ $engine = tree-walk ] && flags="--tree-walk --eval-stats"
+      start=$(date +%s%N)
+      log=$("$BIN" $flags --time --stdout --input "$input" "$(cat "$src")" \
+            2>&1 >/dev/null)
+      status=$?
+      end=$(date +%s%N)
+      [ $status -eq 0 ] || failed=1
+      [ $engine = tree-walk ] && nodes=$(sed -n 's/^eval: nodes //p' <<< "$log")
+      rss=$(sed -n 's/.* peak-rss \([0-9]*\) KiB$/\1/p' <<< "$log")
+      awk -v b="$name" -v e=$engine -v x=$status -v ns=$((end - start)) \
+          -v n="${nodes:-0}" -v r="${rss:-0}" -v out="$OUT" 'BEGIN {
+         s = ns / 1e9
+         printf "%-10s %-10s %4d %10.3f %12d %14.0f %12d\n", b, e, x, s, n,
+            n / s, r
+         printf "{\"bench\": \"%s\", \"engine\": \"%s\", \"exit\": %d, " \
+            "\"wall_s\": %.6f, \"nodes\": %d, \"nodes_per_s\": %.0f, " \
+            "\"peak_rss_kb\": %d}\n", b, e, x, s, n, n / s, r >> out
+      }'
+   done
+done
+exit $failed
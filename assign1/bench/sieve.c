@@ -0,0 +1,30 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Sieve of Eratosthenes: counts the primes below n, n read from input.
+int main() {
+   int n;
+   int i;
+   int j;
+   int count = 0;
+   int *composite;
+   n = GET();
+   composite = (int *)MALLOC(n * sizeof(int));
+   for (i = 0; i < n; i = i + 1)
+      composite[i] = 0;
+   for (i = 2; i * i < n; i = i + 1) {
+      if (composite[i] == 0) {
+         for (j = i * i; j < n; j = j + i)
+            composite[j] = 1;
+      }
+   }
+   for (i = 2; i < n; i = i + 1) {
+      if (composite[i] == 0)
+         count = count + 1;
+   }
+   PRINT(count);
+   FREE(composite);
+   return 0;
+}
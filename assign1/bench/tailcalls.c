@@ -0,0 +1,56 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Tail calls `depth` deep: a self-recursive sum with an accumulator, a
+// mutually recursive even/odd test and a void countdown. Each runs in
+// constant stack space only if its calls reuse the caller's frame.
+// Counting the calls in a global keeps them from being memoized.
+int calls;
+int odd(int n);
+
+int sum(int n, int acc) {
+   calls = calls + 1;
+   if (n == 0)
+      return acc;
+   return sum(n - 1, acc + n);
+}
+
+int even(int n) {
+   calls = calls + 1;
+   if (n == 0)
+      return 1;
+   return odd(n - 1);
+}
+
+int odd(int n) {
+   calls = calls + 1;
+   if (n == 0)
+      return 0;
+   return even(n - 1);
+}
+
+void countdown(int n, int *total) {
+   calls = calls + 1;
+   if (n == 0)
+      return;
+   *total = *total + n;
+   countdown(n - 1, total);
+}
+
+int main() {
+   int depth;
+   int *total;
+   depth = GET();
+   total = (int *)MALLOC(sizeof(int));
+   *total = 0;
+   PRINT(sum(depth, 0));
+   PRINT(even(depth));
+   PRINT(odd(depth + 1));
+   countdown(depth, total);
+   PRINT(*total);
+   PRINT(calls);
+   FREE(total);
+   return 0;
+}
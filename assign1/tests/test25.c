@@ -0,0 +1,42 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// The last call of g passes a local array, so the callee must not take
+// over g's frame.
+void show(int *a, int n) {
+   int b[4];
+   b[0] = 1;
+   b[1] = 2;
+   PRINT(a[0]);
+   if (n > 0)
+      show(a, n - 1);
+}
+
+int sum(int *a, int i) {
+   if (i < 0)
+      return 0;
+   return a[i] + sum(a, i - 1);
+}
+
+int last(int x) {
+   int c[4];
+   c[0] = x;
+   c[1] = x + 1;
+   c[2] = x + 2;
+   c[3] = x + 3;
+   return sum(c, 3);
+}
+
+void g() {
+   int a[4];
+   a[0] = 7;
+   show(a, 2);
+}
+
+int main() {
+   g();
+   PRINT(last(10));
+   return 0;
+}
@@ -0,0 +1,28 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// The value of a call returned as a char is narrowed after the call.
+int wide(int x) {
+   return x * 3;
+}
+
+char narrow(int x) {
+   return wide(x);
+}
+
+unsigned char unsignedNarrow(int x) {
+   return wide(x);
+}
+
+int widen(int x) {
+   return narrow(x);
+}
+
+int main() {
+   PRINT(narrow(100));
+   PRINT(unsignedNarrow(100));
+   PRINT(widen(-50));
+   return 0;
+}
@@ -0,0 +1,60 @@
+extern int GET();
+extern void * MALLOC(int);
+extern void FREE(void *);
+extern void PRINT(int);
+
+// Chars take one byte: char arrays wrap their values, unsigned chars load
+// zero-extended, char pointers step by bytes and int pointers by words. The
+// loop count is read so that hot loops reach the JIT.
+int main() {
+   char s[64];
+   unsigned char u[64];
+   char *p;
+   char *q;
+   int *a;
+   int *b;
+   int n;
+   int i;
+   int r;
+   int sum;
+   n = GET();
+   for (i = 0; i < 64; i = i + 1) {
+      s[i] = i * 7 - 100;
+      u[i] = i * 9 - 1;
+   }
+   PRINT(s[0]);
+   PRINT(s[40]);
+   PRINT(s[63]);
+   PRINT(u[0]);
+   PRINT(u[63]);
+   sum = 0;
+   for (r = 0; r < n; r = r + 1) {
+      p = s;
+      q = s + 63;
+      while (p < q) {
+         sum = sum + *p - *q;
+         p = p + 1;
+         q = q - 1;
+      }
+      sum = sum + u[r - r / 64 * 64];
+   }
+   PRINT(sum);
+   PRINT(q - p);
+   PRINT(p - s);
+   a = (int *)MALLOC(sizeof(int) * n);
+   b = a + n;
+   for (i = 0; i < n; i = i + 1)
+      a[i] = i;
+   sum = 0;
+   while (b > a) {
+      b = b - 1;
+      sum = sum + *b;
+   }
+   PRINT(sum);
+   b = a + n;
+   PRINT(b - a);
+   PRINT((char *)b - (char *)a);
+   PRINT(sizeof(char) + sizeof(s) + sizeof(int));
+   FREE(a);
+   return 0;
+}